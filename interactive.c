@@ -30,106 +30,331 @@
 
 #include "ppup1090.h"
 //
-// ============================= Utility functions ==========================
+//============================== Record pools ==============================
 //
-static uint64_t mstime(void) {
-    struct timeval tv;
-    uint64_t mst;
+// Add a slab of nItems records to the pool, and put them on the free list
+//
+static int poolGrow(struct stPool *p, uint32_t nItems) {
+    struct stPoolSlab *pSlab = (struct stPoolSlab *) malloc(sizeof(*pSlab) + (p->nItemSize * nItems));
+    char              *pItem;
+
+    if (!pSlab) {
+        return (-1);
+    }
+    pSlab->pNext = p->pSlab;
+    p->pSlab     = pSlab;
+
+    pItem = (char *) (pSlab + 1);
+    while (nItems--) {
+        *(void **) pItem = p->pFree;
+        p->pFree         = pItem;
+        pItem           += p->nItemSize;
+        p->nTotal++;
+    }
+    return (0);
+}
+//
+//=========================================================================
+//
+// Initialise a pool of nItemSize records, with nItems preallocated
+//
+int poolInit(struct stPool *p, size_t nItemSize, uint32_t nItems) {
+    memset(p, 0, sizeof(*p));
+    p->nItemSize = (nItemSize + 7) & ~((size_t) 7);
+    return (nItems ? poolGrow(p, nItems) : 0);
+}
+//
+//=========================================================================
+//
+// Take a record from the pool, growing it by another slab if it's empty.
+// Returns NULL if we're out of memory.
+//
+void *poolAlloc(struct stPool *p) {
+    void *pItem;
+
+    if ((!p->pFree) && (poolGrow(p, MODES_POOL_SLAB_LEN))) {
+        return (NULL);
+    }
+    pItem    = p->pFree;
+    p->pFree = *(void **) pItem;
+
+    if (++p->nUsed > p->nHighWater) {
+        p->nHighWater = p->nUsed;
+    }
+    return (pItem);
+}
+//
+//=========================================================================
+//
+// Return a record to the pool
+//
+void poolFree(struct stPool *p, void *pItem) {
+    *(void **) pItem = p->pFree;
+    p->pFree         = pItem;
+    p->nUsed--;
+}
+//
+//========================= ICAO address hash table ========================
+//
+// Allocate an empty table of nSize slots. nSize must be a power of two.
+//
+int icaoHashInit(struct stICAOHash *h, uint32_t nSize) {
+    struct stICAOHashEntry *pSlot = (struct stICAOHashEntry *) calloc(nSize, sizeof(*pSlot));
+
+    if (!pSlot) {
+        return (-1);
+    }
+    h->pSlot  = pSlot;
+    h->nSize  = nSize;
+    h->nCount = 0;
+    return (0);
+}
+//
+//=========================================================================
+//
+// Return the data stored for addr, or NULL if addr is not in the table
+//
+void *icaoHashFind(struct stICAOHash *h, uint32_t addr) {
+    uint32_t mask = h->nSize - 1;
+    uint32_t i    = ICAOHashAddress(addr) & mask;
+
+    while (h->pSlot[i].pData) {
+        if (h->pSlot[i].addr == addr) {
+            return (h->pSlot[i].pData);
+        }
+        i = (i + 1) & mask;
+    }
+    return (NULL);
+}
+//
+//=========================================================================
+//
+// Double the size of the table and re-insert everything. If we can't get
+// the memory we carry on with the old table, which still works but with
+// longer probe sequences.
+//
+static void icaoHashGrow(struct stICAOHash *h) {
+    struct stICAOHash       old = *h;
+    uint32_t                j;
+
+    if (icaoHashInit(h, old.nSize * 2)) {
+        *h = old;
+        return;
+    }
+    for (j = 0; j < old.nSize; j++) {
+        if (old.pSlot[j].pData) {
+            icaoHashInsert(h, old.pSlot[j].addr, old.pSlot[j].pData);
+        }
+    }
+    free(old.pSlot);
+}
+//
+//=========================================================================
+//
+// Add addr to the table, or replace the data if it's already there.
+// Returns 0 on success, or -1 if the table is full and can't be grown.
+//
+int icaoHashInsert(struct stICAOHash *h, uint32_t addr, void *pData) {
+    uint32_t mask;
+    uint32_t i;
+
+    // Keep the load factor at or below 50% so probe sequences stay short
+    if ((h->nCount + 1) * 2 > h->nSize) {
+        icaoHashGrow(h);
+        if (h->nCount + 1 >= h->nSize) {
+            return (-1);
+        }
+    }
+
+    mask = h->nSize - 1;
+    i    = ICAOHashAddress(addr) & mask;
+    while (h->pSlot[i].pData) {
+        if (h->pSlot[i].addr == addr) {
+            h->pSlot[i].pData = pData;
+            return (0);
+        }
+        i = (i + 1) & mask;
+    }
+    h->pSlot[i].addr  = addr;
+    h->pSlot[i].pData = pData;
+    h->nCount++;
+    return (0);
+}
+//
+//=========================================================================
+//
+// Remove addr from the table. Rather than leaving a tombstone, any entries
+// in the same probe run that would no longer be reachable are shifted back
+// into the hole.
+//
+void icaoHashDelete(struct stICAOHash *h, uint32_t addr) {
+    uint32_t mask = h->nSize - 1;
+    uint32_t i    = ICAOHashAddress(addr) & mask;
+    uint32_t j, k;
 
-    gettimeofday(&tv, NULL);
-    mst = ((uint64_t)tv.tv_sec)*1000;
-    mst += tv.tv_usec/1000;
-    return mst;
+    while (h->pSlot[i].pData) {
+        if (h->pSlot[i].addr == addr) {
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+    if (!h->pSlot[i].pData) {
+        return; // Not found
+    }
+
+    j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (!h->pSlot[j].pData) {
+            break;
+        }
+        // k is where the entry in slot j would like to be. If k lies
+        // cyclically in (i, j] it's still reachable, so leave it alone.
+        k = ICAOHashAddress(h->pSlot[j].addr) & mask;
+        if ((i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j))) {
+            continue;
+        }
+        h->pSlot[i] = h->pSlot[j];
+        i = j;
+    }
+    h->pSlot[i].pData = NULL;
+    h->pSlot[i].addr  = 0;
+    h->nCount--;
 }
 //
 //=========================================================================
 //
-// Add a new DF structure to the interactive mode linked list
+// Return the oldest DF in the ring. Only valid if Modes.nDFCount is non zero.
+//
+static struct stDF *interactiveOldestDF(void) {
+    return (&Modes.pDFRing[(Modes.nDFHead + Modes.nDFHistory - Modes.nDFCount) % Modes.nDFHistory]);
+}
+//
+// Drop the oldest DF from the ring, and unlink it from the tail of the list.
+// Must be called with the pDF_mutex held.
+//
+static void interactiveDropOldestDF(void) {
+    struct stDF *pDF = interactiveOldestDF();
+
+    // The list is newest first, so if the index points at this DF there are
+    // no newer DF's for the address left, and the index entry must go too.
+    if (icaoHashFind(&Modes.DFHash, pDF->addr) == pDF) {
+        icaoHashDelete(&Modes.DFHash, pDF->addr);
+    }
+
+    if (pDF->pPrev) {
+        pDF->pPrev->pNext = NULL;
+    } else {
+        Modes.pDF = NULL;
+    }
+    Modes.nDFCount--;
+}
+//
+// Add a new DF structure to the head of the interactive mode DF list
 //
 void interactiveCreateDF(struct aircraft *a, struct modesMessage *mm) {
-    struct stDF *pDF = (struct stDF *) malloc(sizeof(*pDF));
+    struct stDF *pDF;
 
-    if (pDF) {
-        // Default everything to zero/NULL
-        memset(pDF, 0, sizeof(*pDF));
+    // The slot we are about to reuse may still be on the list, and the
+    // uploader could be looking at it, so do everything under the mutex.
+    if (!pthread_mutex_lock(&Modes.pDF_mutex)) {
+        // The oldest DF may only be waiting for interactiveRemoveStaleDF().
+        // If it hasn't expired, the ring is too short for the traffic.
+        if (Modes.nDFCount == (uint32_t) Modes.nDFHistory) {
+            if (((a->seen - interactiveOldestDF()->seen) <= Modes.interactive_delete_ttl)
+             && (Modes.nDFOverwritten++ == 0)) {
+                fprintf(stderr, "DF history full, dropping DF's less than %d seconds old. Try a longer --df-history than %d.\n",
+                        Modes.interactive_delete_ttl, Modes.nDFHistory);
+            }
+            interactiveDropOldestDF();
+        }
+
+        pDF = &Modes.pDFRing[Modes.nDFHead];
+        if (++Modes.nDFHead == (uint32_t) Modes.nDFHistory) {
+            Modes.nDFHead = 0;
+        }
 
-        // Now initialise things
+        // With several shard trackers adding DF's, one may have read the
+        // clock just before another, so don't let the list go backwards.
         pDF->seen        = a->seen;
+        if ((Modes.pDF) && (Modes.pDF->seen > pDF->seen)) {
+            pDF->seen    = Modes.pDF->seen;
+        }
         pDF->llTimestamp = mm->timestampMsg;
         pDF->addr        = mm->addr;
         pDF->pAircraft   = a;
         memcpy(pDF->msg, mm->msg, MODES_LONG_MSG_BYTES);
 
-        if (!pthread_mutex_lock(&Modes.pDF_mutex)) {
-            if ((pDF->pNext = Modes.pDF)) {
-                Modes.pDF->pPrev = pDF;
-            }
-            Modes.pDF = pDF;
-            pthread_mutex_unlock(&Modes.pDF_mutex);
-        } else {
-            free(pDF);
+        pDF->pPrev = NULL;
+        if ((pDF->pNext = Modes.pDF)) {
+            Modes.pDF->pPrev = pDF;
         }
+        Modes.pDF = pDF;
+
+        if (++Modes.nDFCount > Modes.nDFHighWater) {
+            Modes.nDFHighWater = Modes.nDFCount;
+        }
+
+        // This is now the newest DF for this address. If the index can't
+        // be updated it still points at an older (valid) DF.
+        icaoHashInsert(&Modes.DFHash, pDF->addr, pDF);
+        pthread_mutex_unlock(&Modes.pDF_mutex);
     }
 }
 //
-// Remove stale DF's from the interactive mode linked list
+// Remove stale DF's from the interactive mode DF list. The ring is in time
+// order, so we just keep dropping the oldest DF until we reach one which
+// hasn't expired.
 //
 void interactiveRemoveStaleDF(time_t now) {
-    struct stDF *pDF  = NULL;
-    struct stDF *prev = NULL;
 
     // Only fiddle with the DF list if we gain possession of the mutex
     // If we fail to get the mutex we'll get another chance to tidy the
     // DF list in a second or so.
     if (!pthread_mutex_trylock(&Modes.pDF_mutex)) {
-        pDF  = Modes.pDF;
-        while(pDF) {
-            if ((now - pDF->seen) > Modes.interactive_delete_ttl) {
-                if (Modes.pDF == pDF) {
-                    Modes.pDF = NULL;
-                } else {
-                    prev->pNext = NULL;
-                }
-
-                // All DF's in the list from here onwards will be time
-                // expired, so delete them all
-                while (pDF) {
-                    prev = pDF; pDF = pDF->pNext;
-                    free(prev);
-                }
-
-            } else {
-                prev = pDF; pDF = pDF->pNext;
-            }
+        while ( (Modes.nDFCount)
+             && ((now - interactiveOldestDF()->seen) > Modes.interactive_delete_ttl) ) {
+            interactiveDropOldestDF();
         }
         pthread_mutex_unlock (&Modes.pDF_mutex);
     }
 }
 
+//
+// Return the newest DF received from addr, or NULL if there isn't one.
+// Called by the uploader thread, so the index is only touched under the
+// pDF_mutex.
+//
 struct stDF *interactiveFindDF(uint32_t addr) {
     struct stDF *pDF = NULL;
 
     if (!pthread_mutex_lock(&Modes.pDF_mutex)) {
-        pDF = Modes.pDF;
-        while(pDF) {
-            if (pDF->addr == addr) {
-                pthread_mutex_unlock (&Modes.pDF_mutex);
-                return (pDF);
-            }
-            pDF = pDF->pNext;
-        }
+        pDF = (struct stDF *) icaoHashFind(&Modes.DFHash, addr);
         pthread_mutex_unlock (&Modes.pDF_mutex);
     }
-    return (NULL);
+    return (pDF);
 }
 //
 //========================= Interactive mode ===============================
 //
+// Return the shard which tracks addr. The top bits of the hash are used, so
+// the choice of shard doesn't line up with the slots in the shards table.
+//
+struct stShard *interactiveShard(uint32_t addr) {
+    return (&Modes.pShards[(uint32_t) (((uint64_t) ICAOHashAddress(addr) * (uint32_t) Modes.nShards) >> 32)]);
+}
+//
+//=========================================================================
+//
 // Return a new aircraft structure for the interactive mode linked list
 // of aircraft
 //
 struct aircraft *interactiveCreateAircraft(struct modesMessage *mm) {
-    struct aircraft *a = (struct aircraft *) malloc(sizeof(*a));
+    struct aircraft *a = (struct aircraft *) poolAlloc(&interactiveShard(mm->addr)->AircraftPool);
+
+    if (!a) {
+        return (NULL);
+    }
 
     // Default everything to zero/NULL
     memset(a, 0, sizeof(*a));
@@ -162,25 +387,195 @@ struct aircraft *interactiveCreateAircraft(struct modesMessage *mm) {
 // exists with this address.
 //
 struct aircraft *interactiveFindAircraft(uint32_t addr) {
-    struct aircraft *a = Modes.aircrafts;
+    return ((struct aircraft *) icaoHashFind(&interactiveShard(addr)->AircraftHash, addr));
+}
+//
+//================== Mode A/C correlation indexes ==========================
+//
+// Each shard keeps its Mode S aircraft on two sets of chains, one keyed on
+// squawk and one on Mode C altitude. The shards own tracker keeps them up
+// to date as squawks and altitudes change, and interactiveUpdateAircraftModeA()
+// only ever looks at the chains which could hold a match.
+//
+// A squawk is four octal digits, stored one per nibble, so packing the digits
+// together gives every squawk its own bucket.
+//
+static struct aircraft **interactiveSquawkBucket(struct stShard *s, int modeA) {
+    return (&s->pSquawkIndex[ ((modeA >> 3) & 0xE00) | ((modeA >> 2) & 0x1C0)
+                            | ((modeA >> 1) & 0x038) |  (modeA       & 0x007) ]);
+}
+//
+// Mode C altitudes, in 100 feet units, wrap round the table. Anything sharing
+// a bucket is still compared against the exact altitude.
+//
+static struct aircraft **interactiveAltitudeBucket(struct stShard *s, int modeC) {
+    return (&s->pAltitudeIndex[modeC & (MODES_ALTITUDE_INDEX_LEN - 1)]);
+}
+//
+//=========================================================================
+//
+// Take an aircraft out of index k. Does nothing if it isn't in it.
+//
+static void interactiveIndexRemove(struct aircraft *a, int k) {
+    struct stIndexLink *l = &a->Index[k];
 
-    while(a) {
-        if (a->addr == addr) return (a);
-        a = a->next;
+    if (a->nIndexed & (1 << k)) {
+        if ((*l->ppPrev = l->pNext)) {
+            l->pNext->Index[k].ppPrev = l->ppPrev;
+        }
+        l->pNext     = NULL;
+        l->ppPrev    = NULL;
+        a->nIndexed &= ~(1 << k);
     }
-    return (NULL);
+}
+//
+// Move an aircraft to the head of a bucket in index k
+//
+static void interactiveIndexAdd(struct aircraft **ppBucket, struct aircraft *a, int k) {
+    struct stIndexLink *l = &a->Index[k];
+
+    interactiveIndexRemove(a, k);
+    if ((l->pNext = *ppBucket)) {
+        l->pNext->Index[k].ppPrev = &l->pNext;
+    }
+    l->ppPrev    = ppBucket;
+    *ppBucket    = a;
+    a->nIndexed |= (1 << k);
+}
+//
+//=========================================================================
+//
+// Put an aircraft in the expiry wheel slot for the second it'll expire if
+// nothing more is heard from it. See interactiveRemoveStaleShard().
+//
+// s->tWheel has already been dealt with, so level 0 covers the next
+// MODES_WHEEL_LEN seconds after it, and level 1 the blocks after the one
+// it's in.
+//
+static void interactiveScheduleAircraft(struct stShard *s, struct aircraft *a) {
+    time_t            due   = a->seen + Modes.interactive_delete_ttl + 1;
+    time_t            delta = due - s->tWheel;
+    struct aircraft **ppSlot;
+
+    if (delta <= 0) {                        // Only if the clock has gone backwards, so look again next second
+        ppSlot = &s->pWheel[0][(s->tWheel + 1) & MODES_WHEEL_MASK];
+    } else if (delta <= MODES_WHEEL_LEN) {   // Due this turn of level 0
+        ppSlot = &s->pWheel[0][due & MODES_WHEEL_MASK];
+    } else if (((due >> MODES_WHEEL_BITS) - (s->tWheel >> MODES_WHEEL_BITS)) < MODES_WHEEL_LEN) {
+        ppSlot = &s->pWheel[1][(due >> MODES_WHEEL_BITS) & MODES_WHEEL_MASK]; // Due this turn of level 1
+    } else {                                 // Beyond the wheel, so park it in the last slot and look again then
+        ppSlot = &s->pWheel[1][((s->tWheel >> MODES_WHEEL_BITS) - 1) & MODES_WHEEL_MASK];
+    }
+    interactiveIndexAdd(ppSlot, a, MODES_INDEX_EXPIRY);
+}
+//
+// Move everything in an expiry wheel slot onto the list at *ppDue
+//
+static void interactiveTakeSlot(struct aircraft **ppSlot, struct aircraft **ppDue) {
+    if ((*ppDue = *ppSlot)) {
+        (*ppDue)->Index[MODES_INDEX_EXPIRY].ppPrev = ppDue;
+    }
+    *ppSlot = NULL;
+}
+//
+//=========================================================================
+//
+// Add a newly created aircraft to the end of its shards table. Returns 0
+// on success, or -1 if we're out of memory.
+//
+int interactiveAddAircraft(struct aircraft *a) {
+    struct stShard *s = interactiveShard(a->addr);
+    uint32_t        n = s->nAircraft;
+
+    if (n == s->nAircraftSize) {
+        uint32_t          nSize = n ? (n * 2) : MODES_AIRCRAFT_HASH_LEN;
+        struct aircraft **pList = (struct aircraft **) realloc(s->pAircraftList, nSize * sizeof(*pList));
+        if (!pList) {
+            return (-1);
+        }
+        s->pAircraftList = pList;
+        s->nAircraftSize = nSize;
+    }
+
+    if (icaoHashInsert(&s->AircraftHash, a->addr, a)) {
+        return (-1);
+    }
+
+    s->pAircraftList[n] = a;
+    s->nAircraft = n + 1;
+    a->nListPos  = n;
+    return (0);
+}
+//
+//=========================================================================
+//
+// Remove the aircraft at index j in a shards table, and free it. The last
+// aircraft in the table is moved down to fill the hole.
+//
+void interactiveDeleteAircraft(struct stShard *s, uint32_t j) {
+    struct aircraft **pList = s->pAircraftList;
+    struct aircraft  *a     = pList[j];
+    uint32_t          n     = --s->nAircraft;
+
+    interactiveIndexRemove(a, MODES_INDEX_SQUAWK);
+    interactiveIndexRemove(a, MODES_INDEX_ALTITUDE);
+    interactiveIndexRemove(a, MODES_INDEX_EXPIRY);
+    icaoHashDelete(&s->AircraftHash, a->addr);
+    poolFree(&s->AircraftPool, a);
+
+    if (j < n) {
+        pList[j] = pList[n];
+        pList[j]->nListPos = j;
+    }
+    pList[n] = NULL;
+}
+//
+//=========================================================================
+//
+// Number of aircraft in all the shards
+//
+uint32_t interactiveAircraftCount(void) {
+    uint32_t n = 0;
+    int      k;
+
+    for (k = 0; k < Modes.nShards; k++) {
+        n += Modes.pShards[k].nAircraft;
+    }
+    return (n);
+}
+//
+//=========================================================================
+//
+// Thread Modes.aircrafts through every aircraft in every shard, for the
+// uploader. The shards don't keep the 'next' pointers up to date, so this
+// has to be done before each postCOAA(), while the shards are quiet.
+//
+void interactiveLinkAircraft(void) {
+    struct aircraft **ppNext = &Modes.aircrafts;
+    struct stShard   *s;
+    uint32_t          j;
+    int               k;
+
+    for (k = 0; k < Modes.nShards; k++) {
+        s = &Modes.pShards[k];
+        for (j = 0; j < s->nAircraft; j++) {
+            *ppNext = s->pAircraftList[j];
+            ppNext  = &s->pAircraftList[j]->next;
+        }
+    }
+    *ppNext = NULL;
 }
 //
 //=========================================================================
 //
 // We have received a Mode A or C response. 
 //
-// Search through the list of known Mode-S aircraft and tag them if this Mode A/C 
+// Look up the known Mode-S aircraft in the indexes and tag them if this Mode A/C 
 // matches their known Mode S Squawks or Altitudes(+/- 50feet).
 //
 // A Mode S equipped aircraft may also respond to Mode A and Mode C SSR interrogations.
-// We can't tell if this is a Mode A or C, so scan through the entire aircraft list
-// looking for matches on Mode A (squawk) and Mode C (altitude). Flag in the Mode S
+// We can't tell if this is a Mode A or C, so look for matches on both Mode A (squawk)
+// and Mode C (altitude, in this bucket and the ones either side). Flag in the Mode S
 // records that we have had a potential Mode A or Mode C response from this aircraft. 
 //
 // If an aircraft responds to Mode A then it's highly likely to be responding to mode C 
@@ -195,15 +590,22 @@ struct aircraft *interactiveFindAircraft(uint32_t addr) {
 // Note : It's theoretically possible for an aircraft to have the same value for Mode A 
 // and Mode C. Therefore we have to check BOTH A AND C for EVERY S.
 //
+// Only Mode S aircraft with a valid squawk are in the squawk index, and only those
+// with a valid altitude are in the altitude index, so we never see fudged ICAO records.
+//
+// Every shards index is searched, so this must only be called while they're quiet.
+//
 void interactiveUpdateAircraftModeA(struct aircraft *a) {
-    struct aircraft *b = Modes.aircrafts;
+    struct stShard  *s;
+    struct aircraft *b;
+    int      k, modeC;
 
-    while(b) {
-        if ((b->modeACflags & MODEAC_MSG_FLAG) == 0) {// skip any fudged ICAO records 
+    for (k = 0; k < Modes.nShards; k++) {
+        s = &Modes.pShards[k];
 
-            // If both (a) and (b) have valid squawks...
-            if ((a->bFlags & b->bFlags) & MODES_ACFLAGS_SQUAWK_VALID) {
-                // ...check for Mode-A == Mode-S Squawk matches
+        // If (a) has a valid squawk, check for Mode-A == Mode-S Squawk matches
+        if (a->bFlags & MODES_ACFLAGS_SQUAWK_VALID) {
+            for (b = *interactiveSquawkBucket(s, a->modeA); b; b = b->Index[MODES_INDEX_SQUAWK].pNext) {
                 if (a->modeA == b->modeA) { // If a 'real' Mode-S ICAO exists using this Mode-A Squawk
                     b->modeAcount   = a->messages;
                     b->modeACflags |= MODEAC_MSG_MODEA_HIT;
@@ -214,32 +616,42 @@ void interactiveUpdateAircraftModeA(struct aircraft *a) {
                         {a->modeACflags |= MODEAC_MSG_MODES_HIT;}    // flag this ModeA/C probably belongs to a known Mode S                    
                 }
             }
+        }
 
-            // If both (a) and (b) have valid altitudes...
-            if ((a->bFlags & b->bFlags) & MODES_ACFLAGS_ALTITUDE_VALID) {
-                // ... check for Mode-C == Mode-S Altitude matches
-                if (  (a->modeC     == b->modeC    )     // If a 'real' Mode-S ICAO exists at this Mode-C Altitude
-                   || (a->modeC     == b->modeC + 1)     //          or this Mode-C - 100 ft
-                   || (a->modeC + 1 == b->modeC    ) ) { //          or this Mode-C + 100 ft
-                    b->modeCcount   = a->messages;
-                    b->modeACflags |= MODEAC_MSG_MODEC_HIT;
-                    a->modeACflags |= MODEAC_MSG_MODEC_HIT;
-                    if ( (b->modeAcount > 0) &&
-                         (b->modeCcount > 1) )
-                        {a->modeACflags |= (MODEAC_MSG_MODES_HIT | MODEAC_MSG_MODEC_OLD);} // flag this ModeA/C probably belongs to a known Mode S                    
+        // If (a) has a valid altitude, check for Mode-C == Mode-S Altitude matches
+        // at this Mode-C Altitude, this Mode-C - 100 ft and this Mode-C + 100 ft
+        if (a->bFlags & MODES_ACFLAGS_ALTITUDE_VALID) {
+            for (modeC = a->modeC - 1; modeC <= a->modeC + 1; modeC++) {
+                for (b = *interactiveAltitudeBucket(s, modeC); b; b = b->Index[MODES_INDEX_ALTITUDE].pNext) {
+                    if (b->modeC == modeC) { // If a 'real' Mode-S ICAO exists at this Mode-C Altitude
+                        b->modeCcount   = a->messages;
+                        b->modeACflags |= MODEAC_MSG_MODEC_HIT;
+                        a->modeACflags |= MODEAC_MSG_MODEC_HIT;
+                        if ( (b->modeAcount > 0) &&
+                             (b->modeCcount > 1) )
+                            {a->modeACflags |= (MODEAC_MSG_MODES_HIT | MODEAC_MSG_MODEC_OLD);} // flag this ModeA/C probably belongs to a known Mode S                    
+                    }
                 }
             }
         }
-        b = b->next;
     }
 }
 //
 //=========================================================================
 //
-void interactiveUpdateAircraftModeS() {
-    struct aircraft *a = Modes.aircrafts;
+// Try to match every Mode A/C code we've seen with a Mode S aircraft. The
+// two can be in different shards, so this is the one place that looks
+// across them, and it must only be called while they're quiet.
+//
+void interactiveUpdateAircraftModeS(void) {
+    struct stShard *s;
+    uint32_t j;
+    int      k;
 
-    while(a) {
+    for (k = 0; k < Modes.nShards; k++) {
+      s = &Modes.pShards[k];
+      for (j = 0; j < s->nAircraft; j++) {
+        struct aircraft *a = s->pAircraftList[j];
         int flags = a->modeACflags;
         if (flags & MODEAC_MSG_FLAG) { // find any fudged ICAO records
 
@@ -248,8 +660,38 @@ void interactiveUpdateAircraftModeS() {
 
             interactiveUpdateAircraftModeA(a);  // and attempt to match them with Mode-S
         }
-        a = a->next;
+      }
+    }
+}
+//
+//=========================================================================
+//
+// Returns 1 if the odd and even CPR positions were received close enough
+// together to be decoded as a pair.
+//
+// The receivers 12 MHz clock says when each one actually arrived, however
+// long it then took to reach us, so that's used when both came from the
+// same feed with a timestamp. It's 48 bits, so the difference is taken
+// modulo 2^48, either way round. A receiver restart starts its clock again,
+// so our own times have to roughly agree as well. Otherwise we go on when
+// we processed them.
+//
+static int interactiveCPRPaired(struct aircraft *a) {
+    uint64_t llMs = (a->even_cprtime > a->odd_cprtime) ? (a->even_cprtime - a->odd_cprtime)
+                                                       : (a->odd_cprtime - a->even_cprtime);
+    uint64_t llTicks;
+
+    if ( ((a->llOddCPRStamp ^ a->llEvenCPRStamp) & ~MODES_TIMESTAMP_MASK)
+      || ((a->llOddCPRStamp  & MODES_TIMESTAMP_MASK) == 0)
+      || ((a->llEvenCPRStamp & MODES_TIMESTAMP_MASK) == 0) ) {
+        return (llMs <= MODES_CPR_PAIR_MS);
     }
+
+    llTicks = (a->llEvenCPRStamp - a->llOddCPRStamp) & MODES_TIMESTAMP_MASK;
+    if (llTicks > (MODES_TIMESTAMP_MASK >> 1)) {
+        llTicks = (MODES_TIMESTAMP_MASK + 1) - llTicks;
+    }
+    return ((llTicks <= ((uint64_t) MODES_CPR_PAIR_MS * MODES_TIMESTAMP_PER_MS)) && (llMs <= (2 * MODES_CPR_PAIR_MS)));
 }
 //
 //=========================================================================
@@ -257,39 +699,36 @@ void interactiveUpdateAircraftModeS() {
 // Receive new messages and populate the interactive mode with more info
 //
 struct aircraft *interactiveReceiveData(struct modesMessage *mm) {
-    struct aircraft *a, *aux;
+    struct stShard  *s;
+    struct aircraft *a;
+    int              modeC;
 
     // Return if (checking crc) AND (not crcok) AND (not fixed)
     if (mm->crcok == 0)
         return NULL;
 
     // Lookup our aircraft or create a new one
-    a = interactiveFindAircraft(mm->addr);
+    s = interactiveShard(mm->addr);
+    a = (struct aircraft *) icaoHashFind(&s->AircraftHash, mm->addr);
     if (!a) {                              // If it's a currently unknown aircraft....
         a = interactiveCreateAircraft(mm); // ., create a new record for it,
-        a->next = Modes.aircrafts;         // .. and put it at the head of the list
-        Modes.aircrafts = a;
-    } else {
-        /* If it is an already known aircraft, move it on head
-         * so we keep aircrafts ordered by received message time.
-         *
-         * However move it on head only if at least one second elapsed
-         * since the aircraft that is currently on head sent a message,
-         * othewise with multiple aircrafts at the same time we have an
-         * useless shuffle of positions on the screen. */
-        if (0 && Modes.aircrafts != a && (time(NULL) - a->seen) >= 1) {
-            aux = Modes.aircrafts;
-            while(aux->next != a) aux = aux->next;
-            /* Now we are a node before the aircraft to remove. */
-            aux->next = aux->next->next; /* removed. */
-            /* Add on head */
-            a->next = Modes.aircrafts;
-            Modes.aircrafts = a;
+        if (!a) {
+            return NULL;
+        }
+        if (interactiveAddAircraft(a)) {   // .. and add it to the table
+            poolFree(&s->AircraftPool, a);
+            return NULL;
         }
     }
 
     a->signalLevel[a->messages & 7] = mm->signalLevel;// replace the 8th oldest signal strength
-    a->seen      = time(NULL);
+    a->seen      = MODES_NOW();
+
+    // New aircraft go on the expiry wheel. After that, the wheel looks at
+    // a->seen when the aircraft comes due, so there's nothing to do here.
+    if (!(a->nIndexed & (1 << MODES_INDEX_EXPIRY))) {
+        interactiveScheduleAircraft(s, a);
+    }
     a->timestamp = mm->timestampMsg;
     a->messages++;
 
@@ -309,7 +748,14 @@ struct aircraft *interactiveReceiveData(struct modesMessage *mm) {
             a->modeACflags &= ~MODEAC_MSG_MODEC_HIT;
             }
         a->altitude = mm->altitude;
-        a->modeC    = (mm->altitude + 49) / 100;
+        modeC       = (mm->altitude + 49) / 100;
+
+        // Keep Mode S aircraft in the right altitude bucket
+        if ( ((a->modeACflags & MODEAC_MSG_FLAG) == 0)
+          && ((a->modeC != modeC) || (!(a->nIndexed & (1 << MODES_INDEX_ALTITUDE)))) ) {
+            interactiveIndexAdd(interactiveAltitudeBucket(s, modeC), a, MODES_INDEX_ALTITUDE);
+        }
+        a->modeC    = modeC;
     }
 
     // If a (new) SQUAWK has been received, copy it to the aircraft structure
@@ -318,9 +764,32 @@ struct aircraft *interactiveReceiveData(struct modesMessage *mm) {
             a->modeAcount   = 0; // Squawk has changed, so zero the hit count
             a->modeACflags &= ~MODEAC_MSG_MODEA_HIT;
         }
+
+        // Keep Mode S aircraft in the right squawk bucket
+        if ( ((a->modeACflags & MODEAC_MSG_FLAG) == 0)
+          && ((a->modeA != mm->modeA) || (!(a->nIndexed & (1 << MODES_INDEX_SQUAWK)))) ) {
+            interactiveIndexAdd(interactiveSquawkBucket(s, mm->modeA), a, MODES_INDEX_SQUAWK);
+        }
         a->modeA = mm->modeA;
     }
 
+    // Speed and heading from E/W and N/S velocities are only worked out when
+    // the velocities differ from the last ones this aircraft sent
+    if (mm->bFlags & MODES_ACFLAGS_NSEWSPD_VALID) {
+        if ( (a->bFlags & MODES_ACFLAGS_NSEWSPD_VALID)
+          && (a->nLastEW == mm->ew_velocity)
+          && (a->nLastNS == mm->ns_velocity) ) {
+            mm->velocity  = a->nLastSpeed;
+            mm->heading   = a->nLastTrack;
+        } else {
+            decodeModesVelocity(mm);
+            a->nLastEW    = mm->ew_velocity;
+            a->nLastNS    = mm->ns_velocity;
+            a->nLastSpeed = mm->velocity;
+            a->nLastTrack = mm->heading;
+        }
+    }
+
     // If a (new) HEADING has been received, copy it to the aircraft structure
     if (mm->bFlags & MODES_ACFLAGS_HEADING_VALID) {
         a->track = mm->heading;
@@ -348,15 +817,17 @@ struct aircraft *interactiveReceiveData(struct modesMessage *mm) {
         if (mm->bFlags & MODES_ACFLAGS_LLODD_VALID) {
             a->odd_cprlat  = mm->raw_latitude;
             a->odd_cprlon  = mm->raw_longitude;
-            a->odd_cprtime = mstime();
+            a->odd_cprtime = MODES_NOW_MS();
+            a->llOddCPRStamp  = ((uint64_t) mm->feed << 48) | mm->timestampMsg;
         } else {
             a->even_cprlat  = mm->raw_latitude;
             a->even_cprlon  = mm->raw_longitude;
-            a->even_cprtime = mstime();
+            a->even_cprtime = MODES_NOW_MS();
+            a->llEvenCPRStamp = ((uint64_t) mm->feed << 48) | mm->timestampMsg;
         }
 
         // If we have enough recent data, try global CPR
-        if (((mm->bFlags | a->bFlags) & MODES_ACFLAGS_LLEITHER_VALID) == MODES_ACFLAGS_LLBOTH_VALID && abs((int)(a->even_cprtime - a->odd_cprtime)) <= 10000) {
+        if (((mm->bFlags | a->bFlags) & MODES_ACFLAGS_LLEITHER_VALID) == MODES_ACFLAGS_LLBOTH_VALID && interactiveCPRPaired(a)) {
             if (decodeCPR(a, (mm->bFlags & MODES_ACFLAGS_LLODD_VALID), (mm->bFlags & MODES_ACFLAGS_AOG)) == 0) {
                 location_ok = 1;
             }
@@ -410,28 +881,43 @@ struct aircraft *interactiveReceiveData(struct modesMessage *mm) {
 // When in interactive mode If we don't receive new nessages within
 // MODES_INTERACTIVE_DELETE_TTL seconds we remove the aircraft from the list.
 //
-void interactiveRemoveStaleAircrafts(void) {
-    struct aircraft *a = Modes.aircrafts;
-    struct aircraft *prev = NULL;
-    time_t now = time(NULL);
+// This does one shard. Each shards tracker calls it for its own shard.
+//
+// Rather than look at every aircraft every second, each shard keeps its
+// aircraft on a two level timing wheel, in the slot for the second they'd
+// expire if nothing more was heard from them. Receiving a message only
+// updates a->seen. When a slot comes due, anything heard from since it was
+// put there is moved to the slot for its new expiry time, and the rest are
+// deleted. So each second we only look at aircraft which might be due.
+//
+void interactiveRemoveStaleShard(struct stShard *s, time_t now) {
+    struct aircraft *pDue;
+    struct aircraft *a;
 
-    // Only do cleanup once per second
-    if (Modes.last_cleanup_time != now) {
-        Modes.last_cleanup_time = now;
+    // If the clock has jumped a long way forward, turning the wheel through
+    // one full turn of level 1 is enough to visit every aircraft.
+    if ((now - s->tWheel) > (MODES_WHEEL_LEN * MODES_WHEEL_LEN)) {
+        s->tWheel = now - (MODES_WHEEL_LEN * MODES_WHEEL_LEN);
+    }
 
-        interactiveRemoveStaleDF(now);
+    while (s->tWheel < now) {
 
-        while(a) {
+        // Before starting each block, spread the level 1 slot for the
+        // block out over level 0
+        if (((s->tWheel + 1) & MODES_WHEEL_MASK) == 0) {
+            interactiveTakeSlot(&s->pWheel[1][((s->tWheel + 1) >> MODES_WHEEL_BITS) & MODES_WHEEL_MASK], &pDue);
+            while ((a = pDue)) {
+                interactiveScheduleAircraft(s, a);
+            }
+        }
+
+        s->tWheel++;
+        interactiveTakeSlot(&s->pWheel[0][s->tWheel & MODES_WHEEL_MASK], &pDue);
+        while ((a = pDue)) {
             if ((now - a->seen) > Modes.interactive_delete_ttl) {
-                // Remove the element from the linked list, with care
-                // if we are removing the first element
-                if (!prev) {
-                    Modes.aircrafts = a->next; free(a); a = Modes.aircrafts;
-                } else {
-                    prev->next = a->next; free(a); a = prev->next;
-                }
+                interactiveDeleteAircraft(s, a->nListPos);
             } else {
-                prev = a; a = a->next;
+                interactiveScheduleAircraft(s, a);
             }
         }
     }
@@ -439,3 +925,38 @@ void interactiveRemoveStaleAircrafts(void) {
 //
 //=========================================================================
 //
+// The housekeeping which involves every shard. Called once a second, just
+// before postCOAA(), while no shard is changing anything.
+//
+void interactiveHousekeeping(time_t now) {
+    interactiveRemoveStaleDF(now);
+    __atomic_store_n(&Modes.nMetricAircraft, interactiveAircraftCount(), __ATOMIC_RELAXED);
+
+    if (Modes.mode_ac) {
+        interactiveUpdateAircraftModeS();
+    }
+
+    interactiveLinkAircraft();
+}
+//
+//=========================================================================
+//
+// Housekeeping when there are no tracker threads, so everything is done here
+//
+void interactiveRemoveStaleAircrafts(void) {
+    time_t   now = time(NULL);
+    int      k;
+
+    // Only do cleanup once per second
+    if (Modes.last_cleanup_time != now) {
+        Modes.last_cleanup_time = now;
+
+        for (k = 0; k < Modes.nShards; k++) {
+            interactiveRemoveStaleShard(&Modes.pShards[k], now);
+        }
+        interactiveHousekeeping(now);
+    }
+}
+//
+//=========================================================================
+//
@@ -0,0 +1,342 @@
+// ppup1090, a Mode S PlanePlotter Uploader for dump1090 devices.
+//
+// Copyright (C) 2013-2021 by Malcolm Robb <Support@ATTAvionics.com>
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  *  Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//
+//  *  Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+#include "ppup1090.h"
+#include <stdarg.h>
+//
+// A small HTTP endpoint which serves our counters in the Prometheus text
+// format, at /metrics on --metrics-port.
+//
+// Counting costs a plain store for each counter and two clock reads for
+// each batch, and the rest only runs when a scrape arrives. Every counter
+// belongs to the thread that changes it (see MODES_COUNT()) :
+//
+//   reader  - the client and frame counts, and the read latency
+//   decoder - the DF counts, CRC failures, bit error fixes, ICAO cache
+//             lookups, and the decode latency
+//   tracker - its own shard's track latency
+//
+// The scrape is answered by the event loop on the reader thread, which adds
+// up what every thread has counted so far. The aircraft count is sampled at
+// the housekeeping, while the shards are quiet.
+//
+// Without the pipeline everything happens on the reader thread, so the read
+// latency includes decoding and tracking, and the other two stay empty.
+//
+struct stMetricsOut {
+    char *p;            // The response body
+    int   nLen;         // Bytes in it so far
+};
+
+static int bMetricsTruncated;  // Set once we've said the response didn't fit
+//
+// ============================== Collecting ================================
+//
+// Nanoseconds on the monotonic clock, to time the stages with
+//
+uint64_t metricsClock(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec);
+}
+//
+//=========================================================================
+//
+// Add the time since llStart (from metricsClock()) to the histogram l. Only
+// the thread which owns l may call this.
+//
+void metricsLatency(struct stLatency *l, uint64_t llStart) {
+    uint64_t llNs = metricsClock() - llStart;
+    uint64_t llUs = llNs / 1000;
+    int      k    = llUs ? (64 - __builtin_clzll(llUs)) : 0;
+
+    if (k > MODES_LATENCY_BUCKETS) {
+        k = MODES_LATENCY_BUCKETS;
+    }
+    MODES_COUNT(l->nBucket[k], 1);
+    MODES_COUNT(l->llSumNs, llNs);
+}
+//
+// ============================== Reporting =================================
+//
+// Add to the response body. If it doesn't all fit, vsnprintf() returns the
+// length it wanted, so the body stops at the end of the buffer (less the
+// terminating zero) rather than running past it, and we say so once.
+//
+static void metricsPrintf(struct stMetricsOut *o, const char *fmt, ...) {
+    va_list ap;
+    int     room = MODES_METRICS_BUF_LEN - o->nLen;
+    int     n;
+
+    if (room <= 1) {
+        return;
+    }
+    va_start(ap, fmt);
+    n = vsnprintf(o->p + o->nLen, room, fmt, ap);
+    va_end(ap);
+    if (n < 0) {
+        return;
+    }
+    o->nLen = (n < room) ? o->nLen + n : MODES_METRICS_BUF_LEN - 1;
+    if ((n >= room) && (!bMetricsTruncated)) {
+        bMetricsTruncated = 1;
+        fprintf(stderr, "Metrics response truncated to %d bytes, MODES_METRICS_BUF_LEN is too small\n",
+                MODES_METRICS_BUF_LEN - 1);
+    }
+}
+//
+//=========================================================================
+//
+static void metricsHeader(struct stMetricsOut *o, const char *pName, const char *pType, const char *pHelp) {
+    metricsPrintf(o, "# HELP %s %s\n# TYPE %s %s\n", pName, pHelp, pName, pType);
+}
+//
+//=========================================================================
+//
+// One stage's histogram. Each bucket is cumulative, and the count is taken
+// from the buckets so the two always agree, even if the owner is adding to
+// them as we read.
+//
+static void metricsHistogram(struct stMetricsOut *o, const char *pStage, struct stLatency **pl, int nLatency) {
+    uint64_t llSumNs = 0;
+    uint64_t nCount  = 0;
+    int      j, k;
+
+    for (k = 0; k <= MODES_LATENCY_BUCKETS; k++) {
+        for (j = 0; j < nLatency; j++) {
+            nCount += MODES_COUNTER(pl[j]->nBucket[k]);
+        }
+        if (k < MODES_LATENCY_BUCKETS) {
+            metricsPrintf(o, "ppup1090_stage_duration_seconds_bucket{stage=\"%s\",le=\"%g\"} %llu\n",
+                          pStage, (double) (1 << k) / 1e6, (unsigned long long) nCount);
+        } else {
+            metricsPrintf(o, "ppup1090_stage_duration_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n",
+                          pStage, (unsigned long long) nCount);
+        }
+    }
+    for (j = 0; j < nLatency; j++) {
+        llSumNs += MODES_COUNTER(pl[j]->llSumNs);
+    }
+    metricsPrintf(o, "ppup1090_stage_duration_seconds_sum{stage=\"%s\"} %.9f\n", pStage, (double) llSumNs / 1e9);
+    metricsPrintf(o, "ppup1090_stage_duration_seconds_count{stage=\"%s\"} %llu\n", pStage, (unsigned long long) nCount);
+}
+//
+//=========================================================================
+//
+// Build the response body. Called on the reader thread, so the reader's
+// own counters can be read as they are.
+//
+static void metricsFormat(struct stMetricsOut *o, struct client **c, int nClients) {
+    struct stLatency *pl[MODES_MAX_SHARDS];
+    uint32_t nDFCount = 0;
+    uint32_t nDFOverwritten = 0;
+    int      j;
+
+    metricsHeader(o, "ppup1090_feed_reads_total", "counter", "Reads from each Beast feed which returned data");
+    for (j = 0; j < nClients; j++) {
+        metricsPrintf(o, "ppup1090_feed_reads_total{feed=\"%s:%d\"} %llu\n",
+                      Modes.Feed[c[j]->feed].ipaddr, Modes.Feed[c[j]->feed].port, (unsigned long long) c[j]->nReads);
+    }
+    metricsHeader(o, "ppup1090_feed_read_bytes_total", "counter", "Bytes read from each Beast feed");
+    for (j = 0; j < nClients; j++) {
+        metricsPrintf(o, "ppup1090_feed_read_bytes_total{feed=\"%s:%d\"} %llu\n",
+                      Modes.Feed[c[j]->feed].ipaddr, Modes.Feed[c[j]->feed].port, (unsigned long long) c[j]->nReadBytes);
+    }
+    metricsHeader(o, "ppup1090_feed_discarded_bytes_total", "counter", "Bytes thrown away while looking for a Beast frame");
+    for (j = 0; j < nClients; j++) {
+        metricsPrintf(o, "ppup1090_feed_discarded_bytes_total{feed=\"%s:%d\"} %llu\n",
+                      Modes.Feed[c[j]->feed].ipaddr, Modes.Feed[c[j]->feed].port, (unsigned long long) c[j]->nDiscarded);
+    }
+    metricsHeader(o, "ppup1090_feed_reconnects_total", "counter", "Connections made to each Beast feed after the first");
+    for (j = 0; j < nClients; j++) {
+        metricsPrintf(o, "ppup1090_feed_reconnects_total{feed=\"%s:%d\"} %llu\n",
+                      Modes.Feed[c[j]->feed].ipaddr, Modes.Feed[c[j]->feed].port,
+                      (unsigned long long) (c[j]->nConnects ? c[j]->nConnects - 1 : 0));
+    }
+
+    metricsHeader(o, "ppup1090_frames_total", "counter", "Beast frames read, after dropping duplicates");
+    metricsPrintf(o, "ppup1090_frames_total %llu\n", (unsigned long long) Modes.nFrames);
+    metricsHeader(o, "ppup1090_duplicate_frames_total", "counter", "Frames dropped because another feed had already sent them");
+    metricsPrintf(o, "ppup1090_duplicate_frames_total %llu\n", (unsigned long long) Modes.nDedupDropped);
+    metricsHeader(o, "ppup1090_decode_queue_dropped_total", "counter", "Frames dropped because the decoder had fallen behind");
+    metricsPrintf(o, "ppup1090_decode_queue_dropped_total %llu\n", (unsigned long long) Modes.DecodeRing.nDropped);
+
+    metricsHeader(o, "ppup1090_messages_total", "counter", "Mode S messages with a good CRC, by downlink format");
+    for (j = 0; j < 32; j++) {
+        metricsPrintf(o, "ppup1090_messages_total{df=\"%d\"} %u\n", j, MODES_COUNTER(Modes.nDF[j]));
+    }
+    metricsHeader(o, "ppup1090_modeac_messages_total", "counter", "Mode A/C replies");
+    metricsPrintf(o, "ppup1090_modeac_messages_total %u\n", MODES_COUNTER(Modes.nDF[32]));
+    metricsHeader(o, "ppup1090_crc_failures_total", "counter", "Mode S messages with a CRC we couldn't make good");
+    metricsPrintf(o, "ppup1090_crc_failures_total %llu\n", (unsigned long long) MODES_COUNTER(Modes.nBadCRC));
+    metricsHeader(o, "ppup1090_bit_errors_fixed_total", "counter", "Messages made good by fixing bit errors, by how many bits");
+    metricsPrintf(o, "ppup1090_bit_errors_fixed_total{bits=\"1\"} %llu\n", (unsigned long long) MODES_COUNTER(Modes.nFixed[0]));
+    metricsPrintf(o, "ppup1090_bit_errors_fixed_total{bits=\"2\"} %llu\n", (unsigned long long) MODES_COUNTER(Modes.nFixed[1]));
+    metricsHeader(o, "ppup1090_icao_lookups_total", "counter", "Recently seen ICAO address lookups");
+    metricsPrintf(o, "ppup1090_icao_lookups_total{result=\"hit\"} %llu\n", (unsigned long long) MODES_COUNTER(Modes.nICAOHits));
+    metricsPrintf(o, "ppup1090_icao_lookups_total{result=\"miss\"} %llu\n", (unsigned long long) MODES_COUNTER(Modes.nICAOMisses));
+
+    if (!pthread_mutex_lock(&Modes.pDF_mutex)) {
+        nDFCount       = Modes.nDFCount;
+        nDFOverwritten = Modes.nDFOverwritten;
+        pthread_mutex_unlock(&Modes.pDF_mutex);
+    }
+    metricsHeader(o, "ppup1090_aircraft", "gauge", "Aircraft being tracked");
+    metricsPrintf(o, "ppup1090_aircraft %u\n", MODES_COUNTER(Modes.nMetricAircraft));
+    metricsHeader(o, "ppup1090_df_history", "gauge", "DF's in the history for the uploader");
+    metricsPrintf(o, "ppup1090_df_history %u\n", nDFCount);
+    metricsHeader(o, "ppup1090_df_overwritten_total", "counter", "DF's dropped from a full history before they expired");
+    metricsPrintf(o, "ppup1090_df_overwritten_total %u\n", nDFOverwritten);
+
+    if (Modes.bPipelineRunning) {
+        metricsHeader(o, "ppup1090_queue_depth", "gauge", "Items waiting in each pipeline queue");
+        metricsPrintf(o, "ppup1090_queue_depth{queue=\"decode\"} %u\n", ringDepth(&Modes.DecodeRing));
+        for (j = 0; j < Modes.nShards; j++) {
+            metricsPrintf(o, "ppup1090_queue_depth{queue=\"track\",shard=\"%d\"} %u\n", j, ringDepth(&Modes.pShards[j].Ring));
+        }
+    }
+
+    metricsHeader(o, "ppup1090_stage_duration_seconds", "histogram", "Time taken for each read, decode batch and track batch");
+    pl[0] = &Modes.ReadLatency;
+    metricsHistogram(o, "read", pl, 1);
+    pl[0] = &Modes.DecodeLatency;
+    metricsHistogram(o, "decode", pl, 1);
+    for (j = 0; j < Modes.nShards; j++) {
+        pl[j] = &Modes.pShards[j].TrackLatency;
+    }
+    metricsHistogram(o, "track", pl, Modes.nShards);
+}
+//
+// ============================== Serving ===================================
+//
+// Open the listening socket, if there's a metrics port. Returns -1 if we
+// can't.
+//
+int metricsInit(void) {
+    Modes.nMetricsFd = ANET_ERR;
+    if (Modes.nMetricsPort == 0) {
+        return (0);
+    }
+    Modes.nMetricsFd = anetTcpServer(Modes.aneterr, Modes.nMetricsPort, Modes.szMetricsAddr);
+    if (Modes.nMetricsFd == ANET_ERR) {
+        fprintf(stderr, "Error opening the metrics port %s:%d : %s\n", Modes.szMetricsAddr, Modes.nMetricsPort, Modes.aneterr);
+        return (-1);
+    }
+    anetNonBlock(Modes.aneterr, Modes.nMetricsFd);
+    return (0);
+}
+//
+//=========================================================================
+//
+// Close a metrics connection and free its slot
+//
+void metricsClose(struct stScrape *s) {
+    if (s->fd != -1) {
+        close(s->fd);                   // Also removes it from the epoll set
+    }
+    s->fd    = -1;
+    s->nIdle = 0;
+    s->nReq  = 0;
+    s->nPos  = 0;
+    s->nEnd  = 0;
+}
+//
+//=========================================================================
+//
+// Answer the request on a metrics connection, then close it. The socket is
+// non-blocking, and each call does what it can without waiting: read
+// whatever more of the request has arrived, then once its first line is
+// complete (or s->szReq is full), write as much of the response as the
+// socket will take. Returns 0 while there's more to do, with s->nEnd set
+// once the response is waiting to be written, or 1 once s->fd is closed.
+//
+// Any GET of /metrics gets the metrics, anything else a 404. We always
+// close the connection afterwards, so there's no keep-alive to look after.
+//
+int metricsServe(struct stScrape *s, struct client **c, int nClients) {
+    struct stMetricsOut o;
+    char   szHead[MODES_METRICS_HEAD_LEN];
+    int    n;
+
+    if (s->nEnd == 0) {
+        n = read(s->fd, s->szReq + s->nReq, sizeof(s->szReq) - 1 - s->nReq);
+        if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+            return (0);
+        }
+        if (n <= 0) {
+            metricsClose(s);
+            return (1);
+        }
+
+        s->nReq += n;
+        s->szReq[s->nReq] = 0;
+        s->nIdle = 0;
+        if ((!strstr(s->szReq, "\r\n")) && (s->nReq < (int) sizeof(s->szReq) - 1)) {
+            return (0);                 // Wait for the rest of the request line
+        }
+
+        // Build the body after room for the header, then put the header
+        // just in front of it, so the response goes out in one piece
+        o.p    = s->pBuf + MODES_METRICS_HEAD_LEN;
+        o.nLen = 0;
+        if ((!strncmp(s->szReq, "GET /metrics", 12)) && ((s->szReq[12] == ' ') || (s->szReq[12] == '?'))) {
+            metricsFormat(&o, c, nClients);
+            n = snprintf(szHead, sizeof(szHead), "HTTP/1.0 200 OK\r\n"
+                         "Content-Type: text/plain; version=0.0.4\r\n"
+                         "Content-Length: %d\r\n"
+                         "Connection: close\r\n\r\n", o.nLen);
+        } else {
+            n = snprintf(szHead, sizeof(szHead), "HTTP/1.0 404 Not Found\r\n"
+                         "Content-Length: 0\r\n"
+                         "Connection: close\r\n\r\n");
+        }
+        s->nPos  = MODES_METRICS_HEAD_LEN - n;
+        s->nEnd  = MODES_METRICS_HEAD_LEN + o.nLen;
+        memcpy(s->pBuf + s->nPos, szHead, n);
+    }
+
+    while (s->nPos < s->nEnd) {
+        n = write(s->fd, s->pBuf + s->nPos, s->nEnd - s->nPos);
+        if (n > 0) {
+            s->nPos += n;
+            s->nIdle = 0;
+        } else if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+            return (0);                 // Wait till the socket can take more
+        } else if ((n < 0) && (errno == EINTR)) {
+            continue;
+        } else {
+            break;                      // They've gone, give up on them
+        }
+    }
+    metricsClose(s);
+    return (1);
+}
@@ -67,24 +67,56 @@ uint32_t modes_checksum_table[112] = {
 0x000000, 0x000000, 0x000000, 0x000000, 0x000000, 0x000000, 0x000000, 0x000000
 };
 
+//
+// Byte at a time CRC table for the Mode S generator polynomial 0xFFF409.
+// Entry n is the CRC of the single byte n, and produces exactly the same
+// result as xoring together the modes_checksum_table entries for each bit
+// set, but processes a whole byte per lookup rather than a bit at a time.
+//
+uint32_t modes_crc_table[256] = {
+0x000000, 0xfff409, 0x001c1b, 0xffe812, 0x003836, 0xffcc3f, 0x00242d, 0xffd024,
+0x00706c, 0xff8465, 0x006c77, 0xff987e, 0x00485a, 0xffbc53, 0x005441, 0xffa048,
+0x00e0d8, 0xff14d1, 0x00fcc3, 0xff08ca, 0x00d8ee, 0xff2ce7, 0x00c4f5, 0xff30fc,
+0x0090b4, 0xff64bd, 0x008caf, 0xff78a6, 0x00a882, 0xff5c8b, 0x00b499, 0xff4090,
+0x01c1b0, 0xfe35b9, 0x01ddab, 0xfe29a2, 0x01f986, 0xfe0d8f, 0x01e59d, 0xfe1194,
+0x01b1dc, 0xfe45d5, 0x01adc7, 0xfe59ce, 0x0189ea, 0xfe7de3, 0x0195f1, 0xfe61f8,
+0x012168, 0xfed561, 0x013d73, 0xfec97a, 0x01195e, 0xfeed57, 0x010545, 0xfef14c,
+0x015104, 0xfea50d, 0x014d1f, 0xfeb916, 0x016932, 0xfe9d3b, 0x017529, 0xfe8120,
+0x038360, 0xfc7769, 0x039f7b, 0xfc6b72, 0x03bb56, 0xfc4f5f, 0x03a74d, 0xfc5344,
+0x03f30c, 0xfc0705, 0x03ef17, 0xfc1b1e, 0x03cb3a, 0xfc3f33, 0x03d721, 0xfc2328,
+0x0363b8, 0xfc97b1, 0x037fa3, 0xfc8baa, 0x035b8e, 0xfcaf87, 0x034795, 0xfcb39c,
+0x0313d4, 0xfce7dd, 0x030fcf, 0xfcfbc6, 0x032be2, 0xfcdfeb, 0x0337f9, 0xfcc3f0,
+0x0242d0, 0xfdb6d9, 0x025ecb, 0xfdaac2, 0x027ae6, 0xfd8eef, 0x0266fd, 0xfd92f4,
+0x0232bc, 0xfdc6b5, 0x022ea7, 0xfddaae, 0x020a8a, 0xfdfe83, 0x021691, 0xfde298,
+0x02a208, 0xfd5601, 0x02be13, 0xfd4a1a, 0x029a3e, 0xfd6e37, 0x028625, 0xfd722c,
+0x02d264, 0xfd266d, 0x02ce7f, 0xfd3a76, 0x02ea52, 0xfd1e5b, 0x02f649, 0xfd0240,
+0x0706c0, 0xf8f2c9, 0x071adb, 0xf8eed2, 0x073ef6, 0xf8caff, 0x0722ed, 0xf8d6e4,
+0x0776ac, 0xf882a5, 0x076ab7, 0xf89ebe, 0x074e9a, 0xf8ba93, 0x075281, 0xf8a688,
+0x07e618, 0xf81211, 0x07fa03, 0xf80e0a, 0x07de2e, 0xf82a27, 0x07c235, 0xf8363c,
+0x079674, 0xf8627d, 0x078a6f, 0xf87e66, 0x07ae42, 0xf85a4b, 0x07b259, 0xf84650,
+0x06c770, 0xf93379, 0x06db6b, 0xf92f62, 0x06ff46, 0xf90b4f, 0x06e35d, 0xf91754,
+0x06b71c, 0xf94315, 0x06ab07, 0xf95f0e, 0x068f2a, 0xf97b23, 0x069331, 0xf96738,
+0x0627a8, 0xf9d3a1, 0x063bb3, 0xf9cfba, 0x061f9e, 0xf9eb97, 0x060385, 0xf9f78c,
+0x0657c4, 0xf9a3cd, 0x064bdf, 0xf9bfd6, 0x066ff2, 0xf99bfb, 0x0673e9, 0xf987e0,
+0x0485a0, 0xfb71a9, 0x0499bb, 0xfb6db2, 0x04bd96, 0xfb499f, 0x04a18d, 0xfb5584,
+0x04f5cc, 0xfb01c5, 0x04e9d7, 0xfb1dde, 0x04cdfa, 0xfb39f3, 0x04d1e1, 0xfb25e8,
+0x046578, 0xfb9171, 0x047963, 0xfb8d6a, 0x045d4e, 0xfba947, 0x044155, 0xfbb55c,
+0x041514, 0xfbe11d, 0x04090f, 0xfbfd06, 0x042d22, 0xfbd92b, 0x043139, 0xfbc530,
+0x054410, 0xfab019, 0x05580b, 0xfaac02, 0x057c26, 0xfa882f, 0x05603d, 0xfa9434,
+0x05347c, 0xfac075, 0x052867, 0xfadc6e, 0x050c4a, 0xfaf843, 0x051051, 0xfae458,
+0x05a4c8, 0xfa50c1, 0x05b8d3, 0xfa4cda, 0x059cfe, 0xfa68f7, 0x0580e5, 0xfa74ec,
+0x05d4a4, 0xfa20ad, 0x05c8bf, 0xfa3cb6, 0x05ec92, 0xfa189b, 0x05f089, 0xfa0480
+};
+
 uint32_t modesChecksum(unsigned char *msg, int bits) {
-    uint32_t   crc = 0;
-    uint32_t   rem = 0;
-    int        offset = (bits == 112) ? 0 : (112-56);
-    uint8_t    theByte = *msg;
-    uint32_t * pCRCTable = &modes_checksum_table[offset];
-    int j;
+    uint32_t crc = 0;
+    uint32_t rem;
+    int      j;
 
     // We don't really need to include the checksum itself
-    bits -= 24;
-    for(j = 0; j < bits; j++) {
-        if ((j & 7) == 0)
-            theByte = *msg++;
-
-        // If bit is set, xor with corresponding table entry.
-        if (theByte & 0x80) {crc ^= *pCRCTable;} 
-        pCRCTable++;
-        theByte = theByte << 1; 
+    bits = (bits - 24) / 8;
+    for (j = 0; j < bits; j++) {
+        crc = (crc << 8) ^ modes_crc_table[((crc >> 16) ^ *msg++) & 0xFF];
     }
 
     rem = (msg[0] << 16) | (msg[1] << 8) | msg[2]; // message checksum
@@ -93,6 +125,155 @@ uint32_t modesChecksum(unsigned char *msg, int bits) {
 //
 //=========================================================================
 //
+// Each step of modesChecksum() needs the result of the one before, so a
+// message takes as long as eleven table lookups one after the other, however
+// many messages there are. But the checksum is linear, so it's also the xor
+// of one entry per byte from a table for each byte position, holding the
+// checksum of that byte with zeros either side. Those lookups don't depend
+// on each other, so the CPU can overlap them within a message and across a
+// batch of messages.
+//
+// A short message has the same checksum as a long one with seven zero bytes
+// in front, so it only uses the last four tables.
+//
+#define MODES_CRC_SLICES (MODES_LONG_MSG_BYTES - 3)
+
+static uint32_t modes_crc_slice[MODES_CRC_SLICES][256];
+
+void modesInitChecksum(void) {
+    uint32_t crc;
+    int      j, v, k;
+
+    for (j = 0; j < MODES_CRC_SLICES; j++) {
+        for (v = 0; v < 256; v++) {
+            crc = 0;
+            for (k = 0; k < 8; k++) {
+                if (v & (0x80 >> k)) {
+                    crc ^= modes_checksum_table[(j * 8) + k];
+                }
+            }
+            modes_crc_slice[j][v] = crc;
+        }
+    }
+
+    modesInitSyndromes();
+}
+//
+//=========================================================================
+//
+// Work out the checksum syndromes of n messages at once. crc[j] ends up the
+// same as modesChecksum(msg[j], bits[j]). modesInitChecksum() must have been
+// called first.
+//
+void modesChecksumBatch(unsigned char *msg[], const int bits[], uint32_t crc[], int n) {
+    const uint32_t (*t)[256] = modes_crc_slice;
+    unsigned char   *p;
+    int              j;
+
+    for (j = 0; j < n; j++) {
+        p = msg[j];
+        if (bits[j] == MODES_LONG_MSG_BITS) {
+            crc[j] = t[0][p[0]] ^ t[1][p[1]] ^ t[2][p[2]] ^ t[3][p[3]]
+                   ^ t[4][p[4]] ^ t[5][p[5]] ^ t[6][p[6]] ^ t[7][p[7]]
+                   ^ t[8][p[8]] ^ t[9][p[9]] ^ t[10][p[10]]
+                   ^ ((p[11] << 16) | (p[12] << 8) | p[13]);
+        } else {
+            crc[j] = t[7][p[0]] ^ t[8][p[1]] ^ t[9][p[2]] ^ t[10][p[3]]
+                   ^ ((p[4] << 16) | (p[5] << 8) | p[6]);
+        }
+    }
+}
+//
+//========================= Bit error correction ===========================
+//
+// A message with a bit error in position n has a checksum syndrome of
+// modes_checksum_table[n] (or the matching bit of the checksum itself, if
+// the error is in the last 24 bits), and one with two errors has the xor of
+// the two. So the syndrome says exactly which bits to flip. The Mode S CRC
+// gives every one and two bit error in a long message a different syndrome.
+//
+// A short message is checked the same way as a long one with 56 zero bits in
+// front, so the same table does for both, using only the positions from 56 on.
+//
+// The first 5 bits are the DF, which says how long the message is and how
+// to check it, so errors there aren't fixed.
+//
+#define MODES_SYNDROME_LEN   8192   // Slots, power of two, for the 5778 one and two bit syndromes
+#define MODES_SYNDROME_FIRST 5      // First bit we'll fix
+
+struct stSyndrome {
+    uint32_t      nSyndrome;        // 0 if the slot is empty
+    unsigned char nBits;            // Number of bit errors
+    unsigned char nBit[2];          // Where they are, as positions in a long message
+};
+
+static struct stSyndrome modes_syndrome[MODES_SYNDROME_LEN];
+
+static uint32_t syndromeHash(uint32_t nSyndrome) {
+    return ((nSyndrome ^ (nSyndrome >> 13)) & (MODES_SYNDROME_LEN - 1));
+}
+
+static uint32_t syndromeOfBit(int n) {
+    return ((n < (MODES_LONG_MSG_BITS - 24)) ? modes_checksum_table[n] : ((uint32_t) 1 << (MODES_LONG_MSG_BITS - 1 - n)));
+}
+
+static void syndromeAdd(uint32_t nSyndrome, int nBits, int nBit0, int nBit1) {
+    uint32_t j = syndromeHash(nSyndrome);
+
+    while (modes_syndrome[j].nSyndrome) {
+        j = (j + 1) & (MODES_SYNDROME_LEN - 1);
+    }
+    modes_syndrome[j].nSyndrome = nSyndrome;
+    modes_syndrome[j].nBits     = (unsigned char) nBits;
+    modes_syndrome[j].nBit[0]   = (unsigned char) nBit0;
+    modes_syndrome[j].nBit[1]   = (unsigned char) nBit1;
+}
+
+void modesInitSyndromes(void) {
+    int j, k;
+
+    memset(modes_syndrome, 0, sizeof(modes_syndrome));
+    for (j = MODES_SYNDROME_FIRST; j < MODES_LONG_MSG_BITS; j++) {
+        syndromeAdd(syndromeOfBit(j), 1, j, j);
+        for (k = j + 1; k < MODES_LONG_MSG_BITS; k++) {
+            syndromeAdd(syndromeOfBit(j) ^ syndromeOfBit(k), 2, j, k);
+        }
+    }
+}
+//
+//=========================================================================
+//
+// Try to fix a message with up to nMaxBits bit errors, from its syndrome in
+// mm->crc. Returns the number of bits fixed, with mm->msg corrected and
+// mm->crc zero, or 0 if it couldn't be fixed and the message is untouched.
+//
+static int fixBitErrors(struct modesMessage *mm, int nMaxBits) {
+    const struct stSyndrome *e;
+    int      nOffset = MODES_LONG_MSG_BITS - mm->msgbits;
+    uint32_t j       = syndromeHash(mm->crc);
+    int      k, n;
+
+    for (e = &modes_syndrome[j]; e->nSyndrome != mm->crc; e = &modes_syndrome[j]) {
+        if (!e->nSyndrome) {
+            return (0);
+        }
+        j = (j + 1) & (MODES_SYNDROME_LEN - 1);
+    }
+
+    // The error has to be in bits this message actually has
+    if ((e->nBits > nMaxBits) || (e->nBit[0] < (nOffset + MODES_SYNDROME_FIRST))) {
+        return (0);
+    }
+    for (k = 0; k < e->nBits; k++) {
+        n = e->nBit[k] - nOffset;
+        mm->msg[n >> 3] ^= (0x80 >> (n & 7));
+    }
+    mm->crc = 0;
+    return (e->nBits);
+}
+//
+//=========================================================================
+//
 // Given the Downlink Format (DF) of the message, return the message length in bits.
 //
 // All known DF's 16 or greater are long. All known DF's 15 or less are short. 
@@ -105,28 +286,125 @@ int modesMessageLenByType(int type) {
 //
 //=========================================================================
 //
-// Hash the ICAO address to index our cache of MODES_ICAO_CACHE_LEN
-// elements, that is assumed to be a power of two
+// Hash the ICAO address. The result is a full 32 bit value, callers mask
+// it down to the size of whatever table they are indexing.
 //
-uint32_t ICAOCacheHashAddress(uint32_t a) {
+uint32_t ICAOHashAddress(uint32_t a) {
     // The following three rounds wil make sure that every bit affects
     // every output bit with ~ 50% of probability.
     a = ((a >> 16) ^ a) * 0x45d9f3b;
     a = ((a >> 16) ^ a) * 0x45d9f3b;
     a = ((a >> 16) ^ a);
-    return a & (MODES_ICAO_CACHE_LEN-1);
+    return a;
+}
+//
+//=========================================================================
+//
+// The cache of recently seen ICAO addresses has an entry for every one of
+// the 2^24 addresses, so busy addresses can never push each other out, and a
+// lookup is a single byte read. Each entry is 0 if we haven't seen the address,
+// or else when we last did, in ticks of MODES_ICAO_CACHE_TICK seconds, counted
+// from 1 to 255 and round again.
+//
+// The table is 16MB, but it's allocated zeroed, so only the pages holding
+// addresses we've actually seen ever take up any memory.
+//
+// The ticks wrap, so an address left alone long enough would look recently
+// seen again. To stop that, a slice of the table is swept each second and any
+// expired entries cleared, and the whole table is swept well before a wrap.
+// If no frames arrive for long enough that everything has expired, the whole
+// table is cleared.
+//
+#define MODES_ICAO_CACHE_TICKS (MODES_ICAO_CACHE_TTL / MODES_ICAO_CACHE_TICK)
+
+static uint8_t ICAOCacheTick(time_t t) {
+    return ((uint8_t) (((t / MODES_ICAO_CACHE_TICK) % 255) + 1));
+}
+
+static int ICAOCacheTicksSince(uint8_t now, uint8_t then) {
+    return ((now + 255 - then) % 255);
+}
+//
+//=========================================================================
+//
+// Allocate an empty cache, freeing any old one. Returns -1 if we're out of memory.
+//
+int initRecentlySeenICAOAddrs(void) {
+    free(Modes.icao_cache);
+    if (NULL == (Modes.icao_cache = (uint8_t *) calloc(MODES_ICAO_CACHE_LEN, 1))) {
+        return (-1);
+    }
+    Modes.nICAOCount  = 0;
+    Modes.nICAOHits   = 0;
+    Modes.nICAOMisses = 0;
+    Modes.nICAOSweep  = 0;
+    return (0);
+}
+//
+//=========================================================================
+//
+// Clear the expired entries from the next MODES_ICAO_SWEEP_LEN of the cache.
+// Most of it is empty, so it's scanned a word at a time.
+//
+// If bAll is set, clear every entry in the cache instead.
+//
+static void sweepRecentlySeenICAOAddrs(time_t now, int bAll) {
+    uint8_t   tick = ICAOCacheTick(now);
+    uint8_t  *p    = bAll ? Modes.icao_cache : (Modes.icao_cache + Modes.nICAOSweep);
+    uint8_t  *pEnd = p + (bAll ? MODES_ICAO_CACHE_LEN : MODES_ICAO_SWEEP_LEN);
+    uint64_t  w;
+    int       j;
+
+    for (; p < pEnd; p += sizeof(w)) {
+        memcpy(&w, p, sizeof(w));
+        if (w) {
+            for (j = 0; j < (int) sizeof(w); j++) {
+                if ((p[j]) && ((bAll) || (ICAOCacheTicksSince(tick, p[j]) > MODES_ICAO_CACHE_TICKS))) {
+                    p[j] = 0;
+                    Modes.nICAOCount--;
+                }
+            }
+        }
+    }
+    if (!bAll) {
+        Modes.nICAOSweep = (Modes.nICAOSweep + MODES_ICAO_SWEEP_LEN) & (MODES_ICAO_CACHE_LEN - 1);
+    }
+}
+//
+//=========================================================================
+//
+// Called with the time on every use of the cache, to do the sweeping
+//
+static void expireRecentlySeenICAOAddrs(time_t now) {
+    time_t nSlices = now - Modes.tICAOSweep;
+
+    if (nSlices) {
+        Modes.tICAOSweep = now;
+        if (nSlices > (MODES_ICAO_CACHE_TTL + MODES_ICAO_CACHE_TICK)) {
+            sweepRecentlySeenICAOAddrs(now, 1); // Everything in the cache has expired
+        } else {
+            do {                                // Catch up with any seconds we've missed
+                sweepRecentlySeenICAOAddrs(now, 0);
+            } while (--nSlices > 0);
+        }
+    }
 }
 //
 //=========================================================================
 //
 // Add the specified entry to the cache of recently seen ICAO addresses.
 // Note that we also add a timestamp so that we can make sure that the
-// entry is only valid for MODES_ICAO_CACHE_TTL seconds.
+// entry is only valid for MODES_ICAO_CACHE_TTL seconds, give or take a tick.
 //
 void addRecentlySeenICAOAddr(uint32_t addr) {
-    uint32_t h = ICAOCacheHashAddress(addr);
-    Modes.icao_cache[h*2] = addr;
-    Modes.icao_cache[h*2+1] = (uint32_t) time(NULL);
+    time_t   now = (time_t) (MODES_NOW_MS() / 1000);
+    uint8_t *p   = &Modes.icao_cache[addr & (MODES_ICAO_CACHE_LEN - 1)];
+
+    expireRecentlySeenICAOAddrs(now);
+    if (!*p) {
+        Modes.nICAOCount++;
+    }
+    *p = ICAOCacheTick(now);
 }
 //
 //=========================================================================
@@ -136,12 +414,17 @@ void addRecentlySeenICAOAddr(uint32_t addr) {
 // seconds ago. Otherwise returns 0.
 //
 int ICAOAddressWasRecentlySeen(uint32_t addr) {
-    uint32_t h = ICAOCacheHashAddress(addr);
-    uint32_t a = Modes.icao_cache[h*2];
-    uint32_t t = Modes.icao_cache[h*2+1];
-    uint64_t tn = time(NULL);
-
-    return ( (a) && (a == addr) && ( (tn - t) <= MODES_ICAO_CACHE_TTL) );
+    time_t  now = (time_t) (MODES_NOW_MS() / 1000);
+    uint8_t t;
+
+    expireRecentlySeenICAOAddrs(now);
+    t = Modes.icao_cache[addr & (MODES_ICAO_CACHE_LEN - 1)];
+    if ((t) && (ICAOCacheTicksSince(ICAOCacheTick(now), t) <= MODES_ICAO_CACHE_TICKS)) {
+        MODES_COUNT(Modes.nICAOHits, 1);
+        return (1);
+    }
+    MODES_COUNT(Modes.nICAOMisses, 1);
+    return (0);
 }
 //
 //=========================================================================
@@ -258,12 +541,20 @@ int decodeMovementField(int movement) {
 //
 //=========================================================================
 //
-// Decode a raw Mode S message demodulated as a stream of bytes by detectModeS(), 
-// and split it into fields populating a modesMessage structure.
+// Decoding a raw Mode S message is done in three steps, so that a batch of
+// messages can be decoded a step at a time (see decodeModesBatch()) :
 //
-void decodeModesMessage(struct modesMessage *mm, unsigned char *msg) {
-    char *ais_charset = "?ABCDEFGHIJKLMNOPQRSTUVWXYZ????? ???????????????0123456789??????";
-
+//   decodeModesHeader()  - copy the message and work out its DF and length.
+//                          The caller then works out mm->crc, either with
+//                          modesChecksum() or modesChecksumBatch()
+//   decodeModesAddress() - work out the address, and whether the CRC is OK.
+//                          This uses and updates the ICAO whitelist, so must
+//                          be done in the order the messages arrived
+//   decodeModesFields()  - split the rest of a good message into fields
+//
+// decodeModesMessage() does all three for a single message.
+//
+void decodeModesHeader(struct modesMessage *mm, unsigned char *msg) {
     // Work on our local copy
     memcpy(mm->msg, msg, MODES_LONG_MSG_BYTES);
     msg = mm->msg;
@@ -271,7 +562,12 @@ void decodeModesMessage(struct modesMessage *mm, unsigned char *msg) {
     // Get the message type ASAP as other operations depend on this
     mm->msgtype         = msg[0] >> 3; // Downlink Format
     mm->msgbits         = modesMessageLenByType(mm->msgtype);
-    mm->crc             = modesChecksum(msg, mm->msgbits);
+}
+//
+//=========================================================================
+//
+void decodeModesAddress(struct modesMessage *mm) {
+    unsigned char *msg = mm->msg;
 
     //
     // Note that most of the other computation happens *after* we fix the 
@@ -290,23 +586,34 @@ void decodeModesMessage(struct modesMessage *mm, unsigned char *msg) {
             if (mm->crcok) {
                 addRecentlySeenICAOAddr(mm->addr);
             }
+        } else if ((Modes.nFixBits) && (fixBitErrors(mm, 1))) {
+            // A short message has too few check bits to trust a fix on its
+            // own, so only fix one bit, and only for an address we know
+            mm->iid  = 0;
+            mm->addr = (msg[1] << 16) | (msg[2] << 8) | (msg[3]);
+            if ((mm->crcok = ICAOAddressWasRecentlySeen(mm->addr))) {
+                MODES_COUNT(Modes.nFixed[0], 1);
+            }
         }
 
-    } else if (mm->msgtype == 17) { // DF 17
-        mm->addr  = (msg[1] << 16) | (msg[2] << 8) | (msg[3]); 
-        mm->ca    = (msg[0] & 0x07); // Responder capabilities
+    } else if ((mm->msgtype == 17) || (mm->msgtype == 18)) { // DF 17, DF 18
+        int nFixed = 0;
 
-        if ((mm->crcok = (0 == mm->crc))) {
-            // DF 17 : if crc == 0 try to populate our ICAO addresses whitelist.
-            addRecentlySeenICAOAddr(mm->addr);
+        if ((mm->crc) && (Modes.nFixBits)) {
+            if ((nFixed = fixBitErrors(mm, Modes.nFixBits))) {
+                MODES_COUNT(Modes.nFixed[nFixed - 1], 1);
+                if (((msg[4] >> 3) >= 5) && ((msg[4] >> 3) <= 22)) {
+                    MODES_COUNT(Modes.nFixedPositions, 1);
+                }
+            }
         }
 
-    } else if (mm->msgtype == 18) { // DF 18
         mm->addr  = (msg[1] << 16) | (msg[2] << 8) | (msg[3]); 
-        mm->ca    = (msg[0] & 0x07); // Control Field
+        mm->ca    = (msg[0] & 0x07); // Responder capabilities, or DF 18 Control Field
 
-        if ((mm->crcok = (0 == mm->crc))) {
-            // DF 18 : if crc == 0 try to populate our ICAO addresses whitelist.
+        // If crc == 0 try to populate our ICAO addresses whitelist. A two bit
+        // fix is the likeliest to be wrong, so that doesn't vouch for an address.
+        if ((mm->crcok = (0 == mm->crc)) && (nFixed < 2)) {
             addRecentlySeenICAOAddr(mm->addr);
         }
 
@@ -315,10 +622,16 @@ void decodeModesMessage(struct modesMessage *mm, unsigned char *msg) {
         // addresses. If it matches one, then declare the message as valid
         mm->crcok = ICAOAddressWasRecentlySeen(mm->addr = mm->crc);
     }
-
-    // If we're checking CRC and the CRC is invalid, then we can't trust any 
-    // of the data contents, so save time and give up now.
-    if (!mm->crcok) { return;}
+}
+//
+//=========================================================================
+//
+// Only call this for messages with a good CRC. If the CRC is invalid, then
+// we can't trust any of the data contents.
+//
+void decodeModesFields(struct modesMessage *mm) {
+    char *ais_charset = "?ABCDEFGHIJKLMNOPQRSTUVWXYZ????? ???????????????0123456789??????";
+    unsigned char *msg = mm->msg;
 
     // Fields for DF0, DF16
     if (mm->msgtype == 0  || mm->msgtype == 16) {
@@ -437,15 +750,9 @@ void decodeModesMessage(struct modesMessage *mm, unsigned char *msg) {
                 }
 
                 if (ew_raw && ns_raw) {
-                    // Compute velocity and angle from the two speed components
+                    // Velocity and angle come from the two speed components,
+                    // but they're left to whoever uses them. See decodeModesVelocity()
                     mm->bFlags |= (MODES_ACFLAGS_SPEED_VALID | MODES_ACFLAGS_HEADING_VALID | MODES_ACFLAGS_NSEWSPD_VALID);
-                    mm->velocity = (int) sqrt((ns_vel * ns_vel) + (ew_vel * ew_vel));
-
-                    if (mm->velocity) {
-                        mm->heading = (int) (atan2(ew_vel, ns_vel) * 180.0 / M_PI);
-                        // We don't want negative values but a 0-360 scale
-                        if (mm->heading < 0) mm->heading += 360;
-                    }
                 }
 
             } else if (mesub == 3 || mesub == 4) {
@@ -548,6 +855,153 @@ void decodeModesMessage(struct modesMessage *mm, unsigned char *msg) {
 //
 //=========================================================================
 //
+// Work out the speed and heading of an airborne velocity message from its
+// E/W and N/S velocities. decodeModesFields() leaves this out, because it
+// needs a sqrt() and an atan2(), and most of the time an aircraft sends the
+// same velocities as last time. So only call this for messages with
+// MODES_ACFLAGS_NSEWSPD_VALID set, and only if the answer's needed.
+//
+void decodeModesVelocity(struct modesMessage *mm) {
+    int ew_vel = mm->ew_velocity;
+    int ns_vel = mm->ns_velocity;
+
+    mm->velocity = (int) sqrt((ns_vel * ns_vel) + (ew_vel * ew_vel));
+
+    if (mm->velocity) {
+        mm->heading = (int) (atan2(ew_vel, ns_vel) * 180.0 / M_PI);
+        // We don't want negative values but a 0-360 scale
+        if (mm->heading < 0) mm->heading += 360;
+    }
+}
+//
+//=========================================================================
+//
+// Decode a raw Mode S message demodulated as a stream of bytes by detectModeS(), 
+// and split it into fields populating a modesMessage structure.
+//
+void decodeModesMessage(struct modesMessage *mm, unsigned char *msg) {
+    decodeModesHeader(mm, msg);
+    mm->crc = modesChecksum(mm->msg, mm->msgbits);
+    decodeModesAddress(mm);
+
+    // If we're checking CRC and the CRC is invalid, then we can't trust any 
+    // of the data contents, so save time and give up now.
+    if (mm->crcok) {
+        decodeModesFields(mm);
+    }
+}
+//
+//=========================================================================
+//
+// Grab the timestamp (big endian format), the signal level and the feed
+// index from a frame
+//
+static void decodeBinHeader(const unsigned char *p, struct modesMessage *mm) {
+    mm->timestampMsg = ((uint64_t) p[1] << 40) | ((uint64_t) p[2] << 32) |
+                       ((uint64_t) p[3] << 24) | ((uint64_t) p[4] << 16) |
+                       ((uint64_t) p[5] <<  8) |  (uint64_t) p[6];
+    mm->signalLevel  = p[7];
+    mm->feed         = p[MODES_FRAME_FEED];
+}
+//
+//=========================================================================
+//
+// Fill in mm from an un-escaped Beast frame. p points at the frame type byte,
+// and the feed index follows the frame (see MODES_FRAME_FEED).
+//
+void decodeBinFrame(unsigned char *p, struct modesMessage *mm) {
+    memset(mm, 0, sizeof(*mm));
+    decodeBinHeader(p, mm);
+
+    if (p[0] == '1') { // ModeA or ModeC
+        decodeModeAMessage(mm, ((p[8] << 8) | p[9]));
+    } else {
+        decodeModesMessage(mm, &p[8]);
+    }
+}
+//
+//=========================================================================
+//
+// Decode n un-escaped Beast frames into out[0] to out[n-1]. Each frames[j]
+// points at a frame laid out as for decodeBinFrame(), and out[j] ends up
+// exactly as decodeBinFrame() would leave it.
+//
+// The frames are taken MODES_DECODE_BATCH at a time, and decoded a step at
+// a time (see decodeModesMessage()). First every CRC is worked out, then
+// every address in the order the frames arrived, since that uses and updates
+// the ICAO whitelist. Lastly the good messages are sorted by DF and split
+// into fields, so decodeModesFields() takes the same branches for a run of
+// messages rather than a different set for each one.
+//
+void decodeModesBatch(const uint8_t *frames[], size_t n, struct modesMessage *out) {
+    uint16_t             nStart[33];  // Where each DF starts in nOrder
+    uint16_t             nOrder[MODES_DECODE_BATCH];
+    unsigned char       *pMsg[MODES_DECODE_BATCH];
+    int                  nBits[MODES_DECODE_BATCH];
+    uint32_t             nCRC[MODES_DECODE_BATCH];
+    struct modesMessage *mm;
+    const uint8_t       *p;
+    size_t               base;
+    uint32_t             j, m;
+    int                  df, k;
+
+    memset(out, 0, n * sizeof(*out));
+
+    for (base = 0; base < n; base += m) {
+        m = ((n - base) < MODES_DECODE_BATCH) ? (uint32_t) (n - base) : MODES_DECODE_BATCH;
+
+        // Timestamps, signal levels and message lengths
+        for (j = k = 0; j < m; j++) {
+            p  = frames[base + j];
+            mm = &out[base + j];
+            decodeBinHeader(p, mm);
+            if (p[0] == '1') { // ModeA or ModeC
+                decodeModeAMessage(mm, ((p[8] << 8) | p[9]));
+            } else {
+                decodeModesHeader(mm, (unsigned char *) &p[8]);
+                pMsg[k]     = mm->msg;
+                nBits[k]    = mm->msgbits;
+                nOrder[k++] = (uint16_t) j;
+            }
+        }
+
+        // CRCs for all the Mode S messages together
+        modesChecksumBatch(pMsg, nBits, nCRC, k);
+        while (k--) {
+            out[base + nOrder[k]].crc = nCRC[k];
+        }
+
+        // Addresses, in the order the frames arrived. Count the good
+        // messages of each DF as we go.
+        memset(nStart, 0, sizeof(nStart));
+        for (j = 0; j < m; j++) {
+            mm = &out[base + j];
+            if (frames[base + j][0] != '1') {
+                decodeModesAddress(mm);
+                if (mm->crcok) {
+                    nStart[mm->msgtype + 1]++;
+                }
+            }
+        }
+
+        // Sort the good messages by DF, and then decode the fields
+        for (df = 1; df < 33; df++) {
+            nStart[df] += nStart[df - 1];
+        }
+        for (j = 0; j < m; j++) {
+            mm = &out[base + j];
+            if ((frames[base + j][0] != '1') && (mm->crcok)) {
+                nOrder[nStart[mm->msgtype]++] = (uint16_t) j;
+            }
+        }
+        for (j = 0; j < nStart[31]; j++) {
+            decodeModesFields(&out[base + nOrder[j]]);
+        }
+    }
+}
+//
+//=========================================================================
+//
 // When a new message is available, because it was decoded from the RTL device, 
 // file, or received in the TCP input port, or any other way we can receive a 
 // decoded message, we call this function in order to use the message.
@@ -559,11 +1013,13 @@ void useModesMessage(struct modesMessage *mm) {
     if (mm->crcok) { // not checking, ok or fixed
 
         if (mm->msgtype < 33) {
-          Modes.nDF[mm->msgtype]++;
+          MODES_COUNT(Modes.nDF[mm->msgtype], 1);
         }
 
         // Always track aircraft
         interactiveReceiveData(mm);
+    } else {
+        MODES_COUNT(Modes.nBadCRC, 1);
     }
 }
 //
@@ -581,67 +1037,42 @@ int cprModFunction(int a, int b) {
 //
 // The NL function uses the precomputed table from 1090-WP-9-14
 //
+// cprNLTable[i] is the latitude at which NL drops from 59 - i to 58 - i.
+//
+static const double cprNLTable[63] = {
+    10.47047130, 14.82817437, 18.18626357, 21.02939493, 23.54504487, 25.82924707,
+    27.93898710, 29.91135686, 31.77209708, 33.53993436, 35.22899598, 36.85025108,
+    38.41241892, 39.92256684, 41.38651832, 42.80914012, 44.19454951, 45.54626723,
+    46.86733252, 48.16039128, 49.42776439, 50.67150166, 51.89342469, 53.09516153,
+    54.27817472, 55.44378444, 56.59318756, 57.72747354, 58.84763776, 59.95459277,
+    61.04917774, 62.13216659, 63.20427479, 64.26616523, 65.31845310, 66.36171008,
+    67.39646774, 68.42322022, 69.44242631, 70.45451075, 71.45986473, 72.45884545,
+    73.45177442, 74.43893416, 75.42056257, 76.39684391, 77.36789461, 78.33374083,
+    79.29428225, 80.24923213, 81.19801349, 82.13956981, 83.07199445, 83.99173563,
+    84.89166191, 85.75541621, 86.53536998, 87.00000000,
+    HUGE_VAL,    HUGE_VAL,    HUGE_VAL,    HUGE_VAL,    HUGE_VAL // Padding, so the search is always 6 steps
+};
+//
+// NL is 59 less the number of zone boundaries at or below lat, which we count
+// with a fixed six step binary search over the table. The tests are the same
+// (lat < boundary) ones the old chain of compares made, so the result is
+// identical for every lat, including NaN and infinities.
+//
 int cprNLFunction(double lat) {
+    const double *p = cprNLTable;
+    int nl;
+
     if (lat < 0) lat = -lat; // Table is simmetric about the equator
-    if (lat < 10.47047130) return 59;
-    if (lat < 14.82817437) return 58;
-    if (lat < 18.18626357) return 57;
-    if (lat < 21.02939493) return 56;
-    if (lat < 23.54504487) return 55;
-    if (lat < 25.82924707) return 54;
-    if (lat < 27.93898710) return 53;
-    if (lat < 29.91135686) return 52;
-    if (lat < 31.77209708) return 51;
-    if (lat < 33.53993436) return 50;
-    if (lat < 35.22899598) return 49;
-    if (lat < 36.85025108) return 48;
-    if (lat < 38.41241892) return 47;
-    if (lat < 39.92256684) return 46;
-    if (lat < 41.38651832) return 45;
-    if (lat < 42.80914012) return 44;
-    if (lat < 44.19454951) return 43;
-    if (lat < 45.54626723) return 42;
-    if (lat < 46.86733252) return 41;
-    if (lat < 48.16039128) return 40;
-    if (lat < 49.42776439) return 39;
-    if (lat < 50.67150166) return 38;
-    if (lat < 51.89342469) return 37;
-    if (lat < 53.09516153) return 36;
-    if (lat < 54.27817472) return 35;
-    if (lat < 55.44378444) return 34;
-    if (lat < 56.59318756) return 33;
-    if (lat < 57.72747354) return 32;
-    if (lat < 58.84763776) return 31;
-    if (lat < 59.95459277) return 30;
-    if (lat < 61.04917774) return 29;
-    if (lat < 62.13216659) return 28;
-    if (lat < 63.20427479) return 27;
-    if (lat < 64.26616523) return 26;
-    if (lat < 65.31845310) return 25;
-    if (lat < 66.36171008) return 24;
-    if (lat < 67.39646774) return 23;
-    if (lat < 68.42322022) return 22;
-    if (lat < 69.44242631) return 21;
-    if (lat < 70.45451075) return 20;
-    if (lat < 71.45986473) return 19;
-    if (lat < 72.45884545) return 18;
-    if (lat < 73.45177442) return 17;
-    if (lat < 74.43893416) return 16;
-    if (lat < 75.42056257) return 15;
-    if (lat < 76.39684391) return 14;
-    if (lat < 77.36789461) return 13;
-    if (lat < 78.33374083) return 12;
-    if (lat < 79.29428225) return 11;
-    if (lat < 80.24923213) return 10;
-    if (lat < 81.19801349) return 9;
-    if (lat < 82.13956981) return 8;
-    if (lat < 83.07199445) return 7;
-    if (lat < 83.99173563) return 6;
-    if (lat < 84.89166191) return 5;
-    if (lat < 85.75541621) return 4;
-    if (lat < 86.53536998) return 3;
-    if (lat < 87.00000000) return 2;
-    else return 1;
+
+    if (!(lat < p[31])) p += 32;
+    if (!(lat < p[15])) p += 16;
+    if (!(lat < p[ 7])) p +=  8;
+    if (!(lat < p[ 3])) p +=  4;
+    if (!(lat < p[ 1])) p +=  2;
+    if (!(lat < p[ 0])) p +=  1;
+
+    nl = 59 - (int) (p - cprNLTable);
+    return ((nl < 1) ? 1 : nl);
 }
 //
 //=========================================================================
@@ -660,6 +1091,254 @@ double cprDlonFunction(double lat, int fflag, int surface) {
 //
 //=========================================================================
 //
+// Surface positions only give the position within a 90 degree quadrant, so
+// pick a reference position to say which quadrant. Returns -1 if we don't
+// have one.
+//
+static int cprSurfaceReference(struct aircraft *a, double *pLat, double *pLon) {
+    // a->seen has just been set for the message being decoded
+    if ((a->bFlags & MODES_ACFLAGS_LATLON_VALID) && (((int)(a->seen - a->seenLatLon)) < Modes.interactive_display_ttl)) {
+        *pLat = a->lat;
+        *pLon = a->lon;
+    } else if (Modes.bUserFlags & MODES_USER_LATLON_VALID) {
+        *pLat = Modes.fUserLat;
+        *pLon = Modes.fUserLon;
+    } else {
+        // No local reference, give up
+        return (-1);
+    }
+    return (0);
+}
+#ifdef MODES_CPR_FIXED
+//
+//=========================================================================
+//
+// Fixed point CPR decoding, for CPUs without a fast FPU. Build with
+// "make CPR=fixed" to use these in place of the floating point versions.
+//
+// Angles are 64 bit integers scaled so that 2^32 is 360 degrees, which is
+// about 8.4e-8 degrees per unit. Only the reference positions and the
+// results are converted to and from degrees, everything in between is
+// integer maths. The results agree with the floating point decoder to well
+// within 1e-5 degrees.
+//
+#define CPR_FIXED_90   ((int64_t) 1 << 30)
+#define CPR_FIXED_180  ((int64_t) 1 << 31)
+#define CPR_FIXED_270  ((int64_t) 3 << 30)
+#define CPR_FIXED_360  ((int64_t) 1 << 32)
+//
+// cprNLTable in fixed point, rounded up so that (lat >= boundary) gives the
+// same answer as it would in degrees
+//
+static const int64_t cprNLFixedTable[63] = {
+     124917589,  176907012,  216970576,  250890455,  280903327,  308154921,
+     333325100,  356856388,  379055884,  400147004,  420298294,  439640621,
+     458278009,  476294775,  493760397,  510732936,  527261514,  543388134,
+     559149057,  574575849,  589696199,  604534563,  619112673,  633449951,
+     647563849,  661470114,  675183028,  688715586,  702079666,  715286154,
+     728345061,  741265621,  754056370,  766725217,  779279500,  791726041,
+     804071181,  816320815,  828480417,  840555055,  852549395,  864467699,
+     876313803,  888091078,  899802361,  911449851,  923034937,  934557931,
+     946017637,  957410633,  968730035,  979963240,  991087499, 1002060438,
+    1012796977, 1023101967, 1032407178, 1037950430,
+    CPR_FIXED_360, CPR_FIXED_360, CPR_FIXED_360, CPR_FIXED_360, CPR_FIXED_360
+};
+//
+static int cprNLFixed(int64_t lat) {
+    const int64_t *p = cprNLFixedTable;
+    int nl;
+
+    if (lat < 0) lat = -lat;
+
+    if (lat >= p[31]) p += 32;
+    if (lat >= p[15]) p += 16;
+    if (lat >= p[ 7]) p +=  8;
+    if (lat >= p[ 3]) p +=  4;
+    if (lat >= p[ 1]) p +=  2;
+    if (lat >= p[ 0]) p +=  1;
+
+    nl = 59 - (int) (p - cprNLFixedTable);
+    return ((nl < 1) ? 1 : nl);
+}
+//
+static int cprNFixed(int64_t lat, int fflag) {
+    int nl = cprNLFixed(lat) - (fflag ? 1 : 0);
+    if (nl < 1) nl = 1;
+    return nl;
+}
+//
+// Division rounding towards minus infinity. b must be positive.
+//
+static int64_t cprFloorDiv(int64_t a, int64_t b) {
+    int64_t q = a / b;
+    if ((a % b) < 0) q--;
+    return q;
+}
+//
+static int64_t cprToFixed(double deg) {
+    return ((int64_t) (deg * (CPR_FIXED_360 / 360.0) + ((deg < 0) ? -0.5 : 0.5)));
+}
+//
+static double cprFromFixed(int64_t a) {
+    return (a * (360.0 / CPR_FIXED_360));
+}
+//
+// The angle of CPR value cpr in zone index of nz zones spanning span
+//
+static int64_t cprFixedZone(int64_t span, int nz, int64_t index, int64_t cpr) {
+    return (cprFloorDiv((index * 131072 + cpr) * (span >> 17), nz));
+}
+//
+// The zone index for CPR value cpr nearest the reference ref. This is
+//   floor(ref / D) + trunc(0.5 + mod((int) ref, (int) D) / D - cpr / 2^17)
+// where D = span / nz degrees, exactly as decodeCPRrelative() does it in
+// floating point, including the truncation of ref and D to whole degrees.
+// The terms after the floor are scaled by 2 * spanDeg * 2^17 to keep them whole.
+//
+static int64_t cprFixedIndex(int64_t ref, int64_t span, int spanDeg, int nz, int64_t cpr) {
+    int     refDeg  = (int) ((ref * 360) / CPR_FIXED_360);
+    int     zoneDeg = spanDeg / nz;
+    int64_t frac    = ((int64_t) spanDeg * 131072)
+                    + ((int64_t) cprModFunction(refDeg, zoneDeg) * nz * 2 * 131072)
+                    - ((int64_t) spanDeg * 2 * cpr);
+
+    return (cprFloorDiv(ref * nz, span) + (frac / ((int64_t) spanDeg * 2 * 131072)));
+}
+//
+//=========================================================================
+//
+// Fixed point version of the global decode below
+//
+int decodeCPR(struct aircraft *a, int fflag, int surface) {
+    int64_t span = surface ? CPR_FIXED_90 : CPR_FIXED_360;
+    int64_t lat0 = a->even_cprlat;
+    int64_t lat1 = a->odd_cprlat;
+    int64_t lon0 = a->even_cprlon;
+    int64_t lon1 = a->odd_cprlon;
+    int64_t rlat, rlon, m, quadrant;
+    int     nl, ni;
+
+    // Compute the Latitude Index "j"
+    int     j     = (int) cprFloorDiv(59*lat0 - 60*lat1 + 65536, 131072);
+    int64_t rlat0 = cprFixedZone(span, 60, cprModFunction(j,60), lat0);
+    int64_t rlat1 = cprFixedZone(span, 59, cprModFunction(j,59), lat1);
+
+    double surface_rlat = MODES_USER_LATITUDE_DFLT;
+    double surface_rlon = MODES_USER_LONGITUDE_DFLT;
+
+    if (surface) {
+        // If we're on the ground, make sure we have a (likely) valid Lat/Lon
+        if (cprSurfaceReference(a, &surface_rlat, &surface_rlon)) {
+            return (-1);
+        }
+        quadrant = cprFloorDiv(cprToFixed(surface_rlat), CPR_FIXED_90) * CPR_FIXED_90;
+        rlat0   += quadrant; // Move from 1st quadrant to our quadrant
+        rlat1   += quadrant;
+    } else {
+        if (rlat0 >= CPR_FIXED_270) rlat0 -= CPR_FIXED_360;
+        if (rlat1 >= CPR_FIXED_270) rlat1 -= CPR_FIXED_360;
+    }
+
+    // Check to see that the latitude is in range: -90 .. +90
+    if (rlat0 < -CPR_FIXED_90 || rlat0 > CPR_FIXED_90 || rlat1 < -CPR_FIXED_90 || rlat1 > CPR_FIXED_90)
+        return (-1);
+
+    // Check that both are in the same latitude zone, or abort.
+    if (cprNLFixed(rlat0) != cprNLFixed(rlat1))
+        return (-1);
+
+    // Compute ni and the Longitude Index "m"
+    rlat = fflag ? rlat1 : rlat0; // Use odd or even packet
+    nl   = cprNLFixed(rlat);
+    ni   = cprNFixed(rlat, fflag);
+    m    = cprFloorDiv(lon0 * (nl-1) - lon1 * nl + 65536, 131072);
+    rlon = cprFixedZone(span, ni, cprModFunction((int) m, ni), fflag ? lon1 : lon0);
+
+    if (surface) {
+        rlon += cprFloorDiv(cprToFixed(surface_rlon), CPR_FIXED_90) * CPR_FIXED_90; // Move from 1st quadrant to our quadrant
+    } else if (rlon > CPR_FIXED_180) {
+        rlon -= CPR_FIXED_360;
+    }
+
+    a->lat = cprFromFixed(rlat);
+    a->lon = cprFromFixed(rlon);
+
+    a->seenLatLon      = a->seen;
+    a->timestampLatLon = a->timestamp;
+    a->bFlags         |= (MODES_ACFLAGS_LATLON_VALID | MODES_ACFLAGS_LATLON_REL_OK);
+
+    return 0;
+}
+//
+//=========================================================================
+//
+// Fixed point version of the relative decode below
+//
+int decodeCPRrelative(struct aircraft *a, int fflag, int surface) {
+    int64_t span    = surface ? CPR_FIXED_90 : CPR_FIXED_360;
+    int     spanDeg = surface ? 90 : 360;
+    int     nz      = fflag   ? 59 : 60;
+    int64_t latr, lonr;
+    int64_t lat, lon;
+    int64_t rlat, rlon;
+    int64_t j, m;
+    int     ni;
+
+    if (a->bFlags & MODES_ACFLAGS_LATLON_REL_OK) { // Ok to try aircraft relative first
+        latr = cprToFixed(a->lat);
+        lonr = cprToFixed(a->lon);
+    } else if (Modes.bUserFlags & MODES_USER_LATLON_VALID) { // Try ground station relative next
+        latr = cprToFixed(Modes.fUserLat);
+        lonr = cprToFixed(Modes.fUserLon);
+    } else {
+        return (-1); // Exit with error - can't do relative if we don't have ref.
+    }
+
+    if (fflag) { // odd
+        lat = a->odd_cprlat;
+        lon = a->odd_cprlon;
+    } else {    // even
+        lat = a->even_cprlat;
+        lon = a->even_cprlon;
+    }
+
+    // Compute the Latitude Index "j"
+    j    = cprFixedIndex(latr, span, spanDeg, nz, lat);
+    rlat = cprFixedZone(span, nz, j, lat);
+    if (rlat >= CPR_FIXED_270) rlat -= CPR_FIXED_360;
+
+    // Check to see that the latitude is in range: -90 .. +90, and that
+    // the answer is reasonable - ie no more than 1/2 cell away
+    if ( (rlat < -CPR_FIXED_90) || (rlat > CPR_FIXED_90)
+      || ((llabs(rlat - cprToFixed(a->lat)) * 2 * nz) > span) ) {
+        a->bFlags &= ~MODES_ACFLAGS_LATLON_REL_OK; // This will cause a quick exit next time if no global has been done
+        return (-1);                               // Time to give up - Latitude error
+    }
+
+    // Compute the Longitude Index "m"
+    ni   = cprNFixed(rlat, fflag);
+    m    = cprFixedIndex(lonr, span, spanDeg, ni, lon);
+    rlon = cprFixedZone(span, ni, m, lon);
+    if (rlon > CPR_FIXED_180) rlon -= CPR_FIXED_360;
+
+    // Check to see that answer is reasonable - ie no more than 1/2 cell away
+    if ((llabs(rlon - cprToFixed(a->lon)) * 2 * ni) > span) {
+        a->bFlags &= ~MODES_ACFLAGS_LATLON_REL_OK; // This will cause a quick exit next time if no global has been done
+        return (-1);                               // Time to give up - Longitude error
+    }
+
+    a->lat = cprFromFixed(rlat);
+    a->lon = cprFromFixed(rlon);
+
+    a->seenLatLon      = a->seen;
+    a->timestampLatLon = a->timestamp;
+    a->bFlags         |= (MODES_ACFLAGS_LATLON_VALID | MODES_ACFLAGS_LATLON_REL_OK);
+    return (0);
+}
+#else
+//
+//=========================================================================
+//
 // This algorithm comes from:
 // http://www.lll.lu/~edward/edward/adsb/DecodingADSBposition.html.
 //
@@ -679,20 +1358,12 @@ int decodeCPR(struct aircraft *a, int fflag, int surface) {
     double rlat0 = AirDlat0 * (cprModFunction(j,60) + lat0 / 131072);
     double rlat1 = AirDlat1 * (cprModFunction(j,59) + lat1 / 131072);
 
-    time_t now = time(NULL);
     double surface_rlat = MODES_USER_LATITUDE_DFLT;
     double surface_rlon = MODES_USER_LONGITUDE_DFLT;
 
     if (surface) {
         // If we're on the ground, make sure we have a (likely) valid Lat/Lon
-        if ((a->bFlags & MODES_ACFLAGS_LATLON_VALID) && (((int)(now - a->seenLatLon)) < Modes.interactive_display_ttl)) {
-            surface_rlat = a->lat;
-            surface_rlon = a->lon;
-        } else if (Modes.bUserFlags & MODES_USER_LATLON_VALID) {
-            surface_rlat = Modes.fUserLat;
-            surface_rlon = Modes.fUserLon;
-        } else {
-            // No local reference, give up
+        if (cprSurfaceReference(a, &surface_rlat, &surface_rlon)) {
             return (-1);
         }
         rlat0 += floor(surface_rlat / 90.0) * 90.0;  // Move from 1st quadrant to our quadrant
@@ -818,6 +1489,7 @@ int decodeCPRrelative(struct aircraft *a, int fflag, int surface) {
     a->bFlags         |= (MODES_ACFLAGS_LATLON_VALID | MODES_ACFLAGS_LATLON_REL_OK);
     return (0);
 }
+#endif // MODES_CPR_FIXED
 //
 // ===================== Mode S detection and decoding  ===================
 //
@@ -0,0 +1,485 @@
+// ppup1090, a Mode S PlanePlotter Uploader for dump1090 devices.
+//
+// Copyright (C) 2013-2021 by Malcolm Robb <Support@ATTAvionics.com>
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  *  Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//
+//  *  Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "ppup1090.h"
+//
+// The decode pipeline runs in three stages :
+//
+//   reader  (main thread) - reads the sockets, un-escapes Beast frames and
+//                           pushes them onto Modes.DecodeRing
+//   decoder (one thread)  - turns frames into modesMessages, and pushes those
+//                           with a good CRC onto the ring of the shard that
+//                           tracks their address
+//   tracker (one thread   - updates its shard of the aircraft table, and adds
+//            per shard)     to the DF history
+//
+// Each shard of the aircraft table is only ever changed by its own tracker,
+// the DF history is shared under the pDF_mutex as before, and the ICAO cache
+// is only ever used by the decoder.
+//
+// Once a second the trackers meet at a barrier. Each first drops its own
+// stale aircraft, then the tracker for shard 0 does the housekeeping which
+// looks across every shard (the DF history, the Mode A/C matching and the
+// uploaders aircraft list) and calls postCOAA(), while the others wait.
+//
+// Work moves between the stages in batches. The reader publishes whatever
+// it un-escaped from one read, and the decoder takes up to MODES_DECODE_BATCH
+// frames at a time, decodes them with decodeModesBatch(), and publishes to
+// each tracker once per batch.
+//
+// ============================== SPSC rings ================================
+//
+int ringInit(struct stRing *r, size_t nItemSize, uint32_t nSize) {
+    memset(r, 0, sizeof(*r));
+    if (NULL == (r->pItems = (unsigned char *) malloc(nItemSize * nSize))) {
+        return (-1);
+    }
+    r->nItemSize = nItemSize;
+    r->nSize     = nSize;
+    pthread_mutex_init(&r->mutex, NULL);
+    pthread_cond_init(&r->cond, NULL);
+    return (0);
+}
+//
+//=========================================================================
+//
+// Producer side. Returns the next free slot, or NULL if the ring is full.
+// Once it's filled in, ringPush() adds it to the ring, and a slot that turns
+// out not to be needed can just be left alone. Nothing is passed to the
+// consumer until ringPublish() is called, so a batch of items costs one
+// publish rather than one each.
+//
+void *ringProduce(struct stRing *r) {
+    uint32_t h = r->nFill;
+
+    if ((h - r->nTailCache) == r->nSize) {
+        r->nTailCache = __atomic_load_n(&r->nTail, __ATOMIC_ACQUIRE);
+        if ((h - r->nTailCache) == r->nSize) {
+            return (NULL);
+        }
+    }
+    return (r->pItems + ((h & (r->nSize - 1)) * r->nItemSize));
+}
+//
+//=========================================================================
+//
+void ringPush(struct stRing *r) {
+    r->nFill++;
+}
+//
+//=========================================================================
+//
+// Make everything pushed so far visible to the consumer
+//
+void ringPublish(struct stRing *r) {
+    uint32_t h = r->nFill;
+    uint32_t nDepth;
+
+    if (h == r->nHead) {
+        return;
+    }
+    __atomic_store_n(&r->nPushed, r->nPushed + (h - r->nHead), __ATOMIC_RELAXED);
+    __atomic_store_n(&r->nHead, h, __ATOMIC_RELEASE);
+
+    nDepth = h - r->nTailCache;
+    if (r->nHighWater < nDepth) {
+        r->nHighWater = nDepth;
+    }
+
+    // If the consumer has gone to sleep, wake it. The fence pairs with the
+    // one in ringWait(), so either we see it sleeping or it sees our item.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&r->bSleeping, __ATOMIC_RELAXED)) {
+        ringWake(r);
+    }
+}
+//
+//=========================================================================
+//
+// Consumer side. Returns the oldest item, or NULL if the ring is empty. The
+// item stays valid until ringRelease() hands its slot back to the producer.
+//
+void *ringConsume(struct stRing *r) {
+    uint32_t t = r->nTail;
+
+    if (t == r->nHeadCache) {
+        r->nHeadCache = __atomic_load_n(&r->nHead, __ATOMIC_ACQUIRE);
+        if (t == r->nHeadCache) {
+            return (NULL);
+        }
+    }
+    return (r->pItems + ((t & (r->nSize - 1)) * r->nItemSize));
+}
+//
+//=========================================================================
+//
+void ringRelease(struct stRing *r) {
+    __atomic_store_n(&r->nTail, r->nTail + 1, __ATOMIC_RELEASE);
+}
+//
+//=========================================================================
+//
+// Consumer side. Fill in ppItems with up to nMax of the oldest items, and
+// return how many there were. They stay valid until ringReleaseBatch().
+//
+uint32_t ringConsumeBatch(struct stRing *r, void **ppItems, uint32_t nMax) {
+    uint32_t t = r->nTail;
+    uint32_t n;
+
+    if ((r->nHeadCache - t) < nMax) {
+        r->nHeadCache = __atomic_load_n(&r->nHead, __ATOMIC_ACQUIRE);
+    }
+    n = r->nHeadCache - t;
+    if (n > nMax) {
+        n = nMax;
+    }
+    for (nMax = 0; nMax < n; nMax++, t++) {
+        ppItems[nMax] = r->pItems + ((t & (r->nSize - 1)) * r->nItemSize);
+    }
+    return (n);
+}
+//
+//=========================================================================
+//
+void ringReleaseBatch(struct stRing *r, uint32_t n) {
+    __atomic_store_n(&r->nTail, r->nTail + n, __ATOMIC_RELEASE);
+}
+//
+//=========================================================================
+//
+uint32_t ringDepth(struct stRing *r) {
+    return (__atomic_load_n(&r->nHead, __ATOMIC_ACQUIRE) - __atomic_load_n(&r->nTail, __ATOMIC_ACQUIRE));
+}
+//
+//=========================================================================
+//
+// Consumer side. Sleep until there's an item, *pCount moves on from nSeen,
+// the pipeline is stopping, or nMs milliseconds pass.
+//
+void ringWait(struct stRing *r, uint32_t *pCount, uint32_t nSeen, int nMs) {
+    struct timeval  tv;
+    struct timespec ts;
+
+    gettimeofday(&tv, NULL);
+    ts.tv_sec  = tv.tv_sec + (nMs / 1000);
+    ts.tv_nsec = (tv.tv_usec * 1000) + ((nMs % 1000) * 1000000);
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+
+    __atomic_store_n(&r->bSleeping, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    pthread_mutex_lock(&r->mutex);
+    while ( (r->nTail == __atomic_load_n(&r->nHead, __ATOMIC_ACQUIRE))
+         && ((pCount == NULL) || (__atomic_load_n(pCount, __ATOMIC_ACQUIRE) == nSeen))
+         && (!__atomic_load_n(&Modes.bPipelineStop, __ATOMIC_ACQUIRE)) ) {
+        if (pthread_cond_timedwait(&r->cond, &r->mutex, &ts)) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&r->mutex);
+
+    __atomic_store_n(&r->bSleeping, 0, __ATOMIC_RELAXED);
+}
+//
+//=========================================================================
+//
+void ringWake(struct stRing *r) {
+    pthread_mutex_lock(&r->mutex);
+    pthread_cond_signal(&r->cond);
+    pthread_mutex_unlock(&r->mutex);
+}
+//
+// ============================== Pipeline ==================================
+//
+static void *pipelineDecoder(void *arg) {
+    const uint8_t       *pFrames[MODES_DECODE_BATCH];
+    struct modesMessage *pBatch;
+    struct modesMessage *mm;
+    struct stShard      *s;
+    void                *pSlot;
+    uint64_t             llStart;
+    uint32_t             n, j;
+    int                  k;
+
+    NOTUSED(arg);
+
+    if (NULL == (pBatch = (struct modesMessage *) malloc(MODES_DECODE_BATCH * sizeof(*pBatch)))) {
+        fprintf(stderr, "Out of memory allocating decode batch.\n");
+        exit(1);
+    }
+
+    while (!__atomic_load_n(&Modes.bPipelineStop, __ATOMIC_ACQUIRE)) {
+        if (0 == (n = ringConsumeBatch(&Modes.DecodeRing, (void **) pFrames, MODES_DECODE_BATCH))) {
+            ringWait(&Modes.DecodeRing, NULL, 0, 1000);
+            continue;
+        }
+
+        llStart = metricsClock();
+        decodeModesBatch(pFrames, n, pBatch);
+        metricsLatency(&Modes.DecodeLatency, llStart);
+        ringReleaseBatch(&Modes.DecodeRing, n);
+
+        for (j = 0; j < n; j++) {
+            mm = &pBatch[j];
+
+            // This is useModesMessage(), split between us and the trackers.
+            // Messages with a bad CRC would only be thrown away by the tracker.
+            if (mm->crcok) {
+                if (mm->msgtype < 33) {
+                    MODES_COUNT(Modes.nDF[mm->msgtype], 1);
+                }
+
+                // If the tracker has fallen behind, wait for it rather than drop
+                // messages. The decode ring gives the reader somewhere to put
+                // frames in the meantime.
+                s = interactiveShard(mm->addr);
+                while (NULL == (pSlot = ringProduce(&s->Ring))) {
+                    if (__atomic_load_n(&Modes.bPipelineStop, __ATOMIC_ACQUIRE)) {
+                        free(pBatch);
+                        return (NULL);
+                    }
+                    ringPublish(&s->Ring);
+                    usleep(100);
+                }
+                memcpy(pSlot, mm, sizeof(*mm));
+                ringPush(&s->Ring);
+            } else {
+                MODES_COUNT(Modes.nBadCRC, 1);
+            }
+        }
+
+        // Each tracker gets its share of the batch in one go
+        for (k = 0; k < Modes.nShards; k++) {
+            ringPublish(&Modes.pShards[k].Ring);
+        }
+        __atomic_add_fetch(&Modes.nDecodeDone, n, __ATOMIC_RELEASE);
+    }
+    free(pBatch);
+    return (NULL);
+}
+//
+//=========================================================================
+//
+static void *pipelineTracker(void *arg) {
+    struct stShard      *s = (struct stShard *) arg;
+    struct modesMessage *mm;
+    uint64_t llStart;
+    uint32_t nTicks;
+    time_t   now;
+    int      bStop;
+    int      j;
+
+    for (;;) {
+        // The reader stops ticking before it stops us, so once we've seen
+        // bStop, nTicks won't change again. We only stop when we've caught
+        // up with it, so every tracker has run the same ticks and none is
+        // left at the barrier waiting for one which has gone.
+        bStop  = __atomic_load_n(&Modes.bPipelineStop, __ATOMIC_ACQUIRE);
+        nTicks = __atomic_load_n(&Modes.nTicks, __ATOMIC_ACQUIRE);
+
+        // Take messages in batches, so housekeeping never waits long
+        llStart = metricsClock();
+        for (j = 0; j < MODES_PIPELINE_BATCH; j++) {
+            if (NULL == (mm = (struct modesMessage *) ringConsume(&s->Ring))) {
+                break;
+            }
+            interactiveReceiveData(mm);
+            ringRelease(&s->Ring);
+            __atomic_add_fetch(&s->nDone, 1, __ATOMIC_RELEASE);
+        }
+        if (j) {
+            metricsLatency(&s->TrackLatency, llStart);
+        }
+
+        // Run the housekeeping once for each tick. Ticks are counted rather
+        // than flagged, so if we've fallen behind and missed one we still
+        // run it, and every tracker meets the others at the barrier for the
+        // same tick.
+        while (s->nTicksDone != nTicks) {
+            now = time(NULL);
+            interactiveRemoveStaleShard(s, now);
+
+            pthread_barrier_wait(&Modes.ShardBarrier);
+            if (s == Modes.pShards) {
+                interactiveHousekeeping(now);
+                postCOAA ();
+            }
+            pthread_barrier_wait(&Modes.ShardBarrier);
+            s->nTicksDone++;
+        }
+
+        if (bStop) {
+            break;
+        }
+        if (j == 0) {
+            ringWait(&s->Ring, &Modes.nTicks, nTicks, 1000);
+        }
+    }
+    return (NULL);
+}
+//
+//=========================================================================
+//
+int pipelineInit(void) {
+    uint32_t nSize = 1024;
+    int      j;
+
+    while ((nSize < (uint32_t) Modes.nDecodeRing) && (nSize < 0x10000000)) {
+        nSize <<= 1;
+    }
+    Modes.nDecodeRing = nSize;
+
+    if (ringInit(&Modes.DecodeRing, MODES_FRAME_BYTES, nSize)) {
+        return (-1);
+    }
+    for (j = 0; j < Modes.nShards; j++) {
+        if (ringInit(&Modes.pShards[j].Ring, sizeof(struct modesMessage), MODES_TRACK_RING_LEN)) {
+            return (-1);
+        }
+    }
+    if (pthread_barrier_init(&Modes.ShardBarrier, NULL, Modes.nShards)) {
+        return (-1);
+    }
+    return (0);
+}
+//
+//=========================================================================
+//
+int pipelineStart(void) {
+    int j;
+
+    Modes.bPipelineStop = 0;
+    for (j = 0; j < Modes.nShards; j++) {
+        if (pthread_create(&Modes.pShards[j].thread, NULL, pipelineTracker, &Modes.pShards[j])) {
+            // We can't have fewer trackers than the barrier expects, so
+            // there's no tidy way back from here
+            return (-1);
+        }
+    }
+    if (pthread_create(&Modes.decoder_thread, NULL, pipelineDecoder, NULL)) {
+        return (-1);
+    }
+    Modes.bPipelineRunning = 1;
+    return (0);
+}
+//
+//=========================================================================
+//
+// Stop the decoder and trackers. Call pipelineDrain() first, or anything
+// still in the rings is dropped.
+//
+void pipelineStop(void) {
+    int j;
+
+    if (!Modes.bPipelineRunning) {
+        return;
+    }
+
+    __atomic_store_n(&Modes.bPipelineStop, 1, __ATOMIC_RELEASE);
+    ringWake(&Modes.DecodeRing);
+    pthread_join(Modes.decoder_thread, NULL);
+    for (j = 0; j < Modes.nShards; j++) {
+        ringWake(&Modes.pShards[j].Ring);
+        pthread_join(Modes.pShards[j].thread, NULL);
+    }
+    Modes.bPipelineRunning = 0;
+}
+//
+//=========================================================================
+//
+// Wait until every frame pushed so far has been decoded and tracked. Called
+// on the reader thread.
+//
+void pipelineDrain(void) {
+    struct stShard *s;
+    int j;
+
+    pipelineFlush();
+    while (Modes.bPipelineRunning) {
+        if (__atomic_load_n(&Modes.nDecodeDone, __ATOMIC_ACQUIRE) == Modes.DecodeRing.nPushed) {
+            for (j = 0; j < Modes.nShards; j++) {
+                s = &Modes.pShards[j];
+                if (__atomic_load_n(&s->nDone, __ATOMIC_ACQUIRE) != __atomic_load_n(&s->Ring.nPushed, __ATOMIC_ACQUIRE)) {
+                    break;
+                }
+            }
+            if (j == Modes.nShards) {
+                return;
+            }
+        }
+        usleep(1000);
+    }
+}
+//
+//=========================================================================
+//
+// Reader side. Queue an un-escaped frame for the decoder. If the decoder
+// can't keep up the frame is dropped, rather than stall the socket reads.
+//
+int pipelinePushFrame(unsigned char *p) {
+    unsigned char *pSlot = (unsigned char *) ringProduce(&Modes.DecodeRing);
+
+    if (!pSlot) {
+        Modes.DecodeRing.nDropped++;
+        return (-1);
+    }
+    memcpy(pSlot, p, MODES_FRAME_BYTES);
+    ringPush(&Modes.DecodeRing);
+
+    // Don't let a big read sit on too many frames before the decoder sees them
+    if ((Modes.DecodeRing.nFill - Modes.DecodeRing.nHead) >= MODES_DECODE_BATCH) {
+        ringPublish(&Modes.DecodeRing);
+    }
+    return (0);
+}
+//
+//=========================================================================
+//
+// Reader side. Pass every frame queued so far on to the decoder.
+//
+void pipelineFlush(void) {
+    ringPublish(&Modes.DecodeRing);
+}
+//
+//=========================================================================
+//
+// Reader side. Ask the trackers to run the housekeeping.
+//
+void pipelineTick(void) {
+    int j;
+
+    __atomic_store_n(&Modes.nTicks, Modes.nTicks + 1, __ATOMIC_RELEASE);
+    for (j = 0; j < Modes.nShards; j++) {
+        ringWake(&Modes.pShards[j].Ring);
+    }
+}
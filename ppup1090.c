@@ -53,6 +53,20 @@ void ppup1090InitConfig(void) {
     Modes.net_input_beast_port    = MODES_NET_OUTPUT_BEAST_PORT;
     Modes.interactive_delete_ttl  = MODES_INTERACTIVE_DELETE_TTL;
     Modes.interactive_display_ttl = MODES_INTERACTIVE_DISPLAY_TTL;
+    Modes.nAircraftPool           = MODES_AIRCRAFT_POOL_LEN;
+    Modes.nDFHistory              = MODES_DF_HISTORY_LEN;
+    Modes.nClientBufSize          = MODES_CLIENT_BUF_SIZE;
+    Modes.nFeeds                  = 1;
+    Modes.Feed[0].port            = MODES_NET_OUTPUT_BEAST_PORT;
+    Modes.nDedupWindow            = MODES_DEDUP_WINDOW;
+    Modes.nFixBits                = MODES_FIX_BITS;
+    Modes.bPipeline               = 1;
+    Modes.nDecodeRing             = MODES_DECODE_RING_LEN;
+    Modes.nShards                 = 1;
+    Modes.nMetricsPort            = MODES_METRICS_PORT;
+    Modes.nMetricsFd              = ANET_ERR;
+    strcpy(Modes.Feed[0].ipaddr, PPUP1090_NET_OUTPUT_IP_ADDRESS);
+    strcpy(Modes.szMetricsAddr, PPUP1090_NET_OUTPUT_IP_ADDRESS);
     Modes.fUserLat                = MODES_USER_LATITUDE_DFLT;
     Modes.fUserLon                = MODES_USER_LONGITUDE_DFLT;
 
@@ -71,20 +85,100 @@ void ppup1090InitConfig(void) {
 void ppup1090Init(void) {
 
     int iErr;
+    int j;
 
     pthread_mutex_init(&Modes.pDF_mutex,NULL);
     pthread_mutex_init(&Modes.data_mutex,NULL);
     pthread_cond_init(&Modes.data_cond,NULL);
 
+    modesInitChecksum();
+    modesClockUpdate();
+    Modes.tStart = time(NULL);
+
     // Allocate the various buffers used by Modes
-    if ( NULL == (Modes.icao_cache = (uint32_t *) malloc(sizeof(uint32_t) * MODES_ICAO_CACHE_LEN * 2)))
+    if (initRecentlySeenICAOAddrs())
     {
         fprintf(stderr, "Out of memory allocating data buffer.\n");
         exit(1);
     }
 
-    // Clear the buffers that have just been allocated, just in-case
-    memset(Modes.icao_cache, 0,   sizeof(uint32_t) * MODES_ICAO_CACHE_LEN * 2);
+    if (icaoHashInit(&Modes.DFHash, MODES_AIRCRAFT_HASH_LEN))
+    {
+        fprintf(stderr, "Out of memory allocating DF index.\n");
+        exit(1);
+    }
+
+#ifdef _WIN32
+    // The Windows build has no event loop, so it can only read one feed,
+    // and has nothing to serve the metrics
+    if (Modes.nFeeds > 1) {
+        fprintf(stderr, "Only one Beast input feed is supported on Windows.\n");
+        Modes.nFeeds = 1;
+    }
+    if (Modes.nMetricsPort) {
+        fprintf(stderr, "--metrics-port is not supported on Windows.\n");
+        Modes.nMetricsPort = 0;
+    }
+#endif
+
+    // Frames only need de-duplicating if they can arrive from more than one feed
+    if ( (Modes.nFeeds > 1)
+      && (NULL == (Modes.pDedup = (struct stDedupEntry *) calloc(MODES_DEDUP_LEN, sizeof(struct stDedupEntry)))) )
+    {
+        fprintf(stderr, "Out of memory allocating duplicate frame table.\n");
+        exit(1);
+    }
+
+    // The decode pipeline is only used on a live feed. Windows has no event loop
+    // to run the reader, so it stays single threaded.
+#ifdef _WIN32
+    Modes.bPipeline = 0;
+#endif
+    if (Modes.pReplayFile) {
+        Modes.bPipeline = 0;
+    }
+
+    // Without the pipeline there's only one thread to do the tracking, so
+    // there's nothing to gain from more than one shard
+    if ((!Modes.bPipeline) || (Modes.nShards < 1)) {
+        Modes.nShards = 1;
+    } else if (Modes.nShards > MODES_MAX_SHARDS) {
+        Modes.nShards = MODES_MAX_SHARDS;
+    }
+    if ( NULL == (Modes.pShards = (struct stShard *) calloc(Modes.nShards, sizeof(struct stShard))))
+    {
+        fprintf(stderr, "Out of memory allocating aircraft table.\n");
+        exit(1);
+    }
+    for (j = 0; j < Modes.nShards; j++) {
+        if (icaoHashInit(&Modes.pShards[j].AircraftHash, MODES_AIRCRAFT_HASH_LEN))
+        {
+            fprintf(stderr, "Out of memory allocating aircraft table.\n");
+            exit(1);
+        }
+        if (poolInit(&Modes.pShards[j].AircraftPool, sizeof(struct aircraft), Modes.nAircraftPool / Modes.nShards))
+        {
+            fprintf(stderr, "Out of memory allocating record pools.\n");
+            exit(1);
+        }
+        Modes.pShards[j].tWheel = time(NULL);
+    }
+
+    if ((Modes.bPipeline) && (pipelineInit()))
+    {
+        fprintf(stderr, "Out of memory allocating decode pipeline.\n");
+        exit(1);
+    }
+
+    // The DF history is a fixed length ring, so this is all the memory it will ever use
+    if (Modes.nDFHistory < 1) {
+        Modes.nDFHistory = 1;
+    }
+    if ( NULL == (Modes.pDFRing = (struct stDF *) calloc(Modes.nDFHistory, sizeof(struct stDF))))
+    {
+        fprintf(stderr, "Out of memory allocating DF history.\n");
+        exit(1);
+    }
 
     // Validate the users Lat/Lon home location inputs
     if ( (Modes.fUserLat >   90.0)  // Latitude must be -90 to +90
@@ -113,7 +207,8 @@ void ppup1090Init(void) {
     strcpy(coaa1090.strRegNo,   STR(USER_REGNO));
     strcpy(coaa1090.strVersion, MODES_PPUP1090_VERSION);
 
-    if ((iErr = initCOAA (coaa1090)))
+    // Nothing gets uploaded from a replay
+    if ((!Modes.pReplayFile) && ((iErr = initCOAA (coaa1090))))
     {
         fprintf(stderr, "Error 0x%X initialising uploader\n", iErr);
         exit(1);
@@ -140,63 +235,251 @@ void modesInitNet(void) {
 //
 //=========================================================================
 //
-// This function decodes a Beast binary format message
+// ========================= Duplicate frame handling =======================
+//
+// With several receivers feeding us, most frames arrive once from each of
+// them. We remember each frame for a short window, and drop any
+// identical frame from another feed which turns up inside it. An identical
+// frame from the same feed is a real repeat (an all-call reply, or an
+// unchanged surveillance reply), so it's kept. Lookups hash the frame bytes
+// and search a few slots from there, so the cost is the same whatever the
+// traffic. If those slots are all busy, the oldest is reused, which at
+// worst lets a duplicate through.
+//
+static uint32_t dedupHash(unsigned char *msg, int len) {
+    uint32_t hash = 2166136261u;          // FNV-1a
+    int      j;
+
+    for (j = 0; j < len; j++) {
+        hash = (hash ^ msg[j]) * 16777619u;
+    }
+    return (hash);
+}
+//
+//=========================================================================
+//
+// Returns 1 if this frame is a duplicate and should be dropped. Otherwise
+// the frame is remembered and 0 is returned.
+//
+static int dedupFrame(unsigned char *msg, int len, int feed) {
+    uint32_t hash = dedupHash(msg, len);
+    uint32_t slot = hash & (MODES_DEDUP_LEN - 1);
+    uint64_t llOldest = 0xFFFFFFFFFFFFFFFFULL;
+    struct stDedupEntry *e, *pReuse = NULL;
+    int j;
+
+    for (j = 0; j < MODES_DEDUP_PROBE; j++) {
+        e = &Modes.pDedup[(slot + j) & (MODES_DEDUP_LEN - 1)];
+        if ( (e->len == len) && (e->hash == hash)
+          && ((Modes.llNowMs - e->llSeen) < (uint64_t) Modes.nDedupWindow)
+          && (memcmp(e->msg, msg, len) == 0) ) {
+            if (e->feed != feed) {
+                Modes.nDedupDropped++;
+                return (1);
+            }
+            e->llSeen = Modes.llNowMs;  // A repeat from the same receiver
+            return (0);
+        }
+        if (e->llSeen < llOldest) {
+            llOldest = e->llSeen;
+            pReuse   = e;
+        }
+    }
+
+    pReuse->llSeen = Modes.llNowMs;
+    pReuse->hash   = hash;
+    pReuse->len    = len;
+    pReuse->feed   = feed;
+    memcpy(pReuse->msg, msg, len);
+    return (0);
+}
+//
+//=========================================================================
+//
+// This function decodes a Beast binary format message. p points at the
+// frame type byte of a complete frame which has already been un-escaped.
 //
 // The message is passed to the higher level layers, so it feeds
-// the selected screen output, the network output and so forth.
+// the selected screen output, the network output and so forth. When the
+// decode pipeline is running, the frame is queued for the decoder thread
+// instead.
 //
 // If the message looks invalid it is silently discarded.
 //
 // The function always returns 0 (success) to the caller as there is no
 // case where we want broken messages here to close the client connection.
 //
-int decodeBinMessage(char *p) {
-    int msgLen = 0;
-    int  j;
-    char ch;
-    char * ptr;
-    unsigned char msg[MODES_LONG_MSG_BYTES];
+int decodeBinMessage(unsigned char *p) {
+    unsigned char ch = p[0]; // Get the message type
     struct modesMessage mm;
-    memset(&mm, 0, sizeof(mm));
 
-    ch = *p++; /// Get the message type
-    if (0x1A == ch) {p++;} 
+    if ((ch == '1') && (!Modes.mode_ac)) { // skip ModeA/C unless user enables --modes-ac
+        return (0);
+    }
 
-    if       ((ch == '1') && (Modes.mode_ac)) { // skip ModeA/C unless user enables --modes-ac
-        msgLen = MODEAC_MSG_BYTES;
-    } else if (ch == '2') {
-        msgLen = MODES_SHORT_MSG_BYTES;
-    } else if (ch == '3') {
-        msgLen = MODES_LONG_MSG_BYTES;
+    // Frames may be arriving from more than one receiver. Mode A/C replies
+    // are just a code, which many aircraft share and repeat all the time,
+    // so there's no telling a copy from another reply and they're all kept.
+    if ( (Modes.pDedup) && (ch != '1')
+      && (dedupFrame(&p[8], (ch == '2') ? MODES_SHORT_MSG_BYTES : MODES_LONG_MSG_BYTES, p[MODES_FRAME_FEED])) ) {
+        return (0);
     }
 
-    if (msgLen) {
-        // Mark messages received over the internet as remote so that we don't try to
-        // pass them off as being received by this instance when forwarding them
+    Modes.nFrames++;
+    if (Modes.bPipelineRunning) {
+        pipelinePushFrame(p);
+        return (0);
+    }
+    if (Modes.nReplayStage == MODES_REPLAY_FRAME) {
+        return (0);
+    }
 
-        ptr = (char*) &mm.timestampMsg;
-        for (j = 0; j < 6; j++) { // Grab the timestamp (big endian format)
-            ptr[5-j] = ch = *p++; 
-            if (0x1A == ch) {p++;}
-        }
+    decodeBinFrame(p, &mm);
 
-        mm.signalLevel = ch = *p++;  // Grab the signal level
-        if (0x1A == ch) {p++;}
+    if (Modes.nReplayStage == MODES_REPLAY_DECODE) {
+        return (0);
+    }
 
-        for (j = 0; j < msgLen; j++) { // and the data
-            msg[j] = ch = *p++;
-            if (0x1A == ch) {p++;}
+    useModesMessage(&mm);
+    return (0);
+}
+//
+//=========================================================================
+//
+// Feed len bytes of a Beast binary stream through the clients parser.
+//
+// Frames start with a 0x1A followed by a type byte, and any 0x1A in the
+// body is doubled. We un-escape into c->frame as we go, and hand each
+// complete frame to decodeBinMessage(). The parser state lives in the
+// client, so frames which are split across reads are simply picked up
+// where we left off, and every byte is looked at exactly once.
+//
+void modesParseBeast(struct client *c, unsigned char *p, int len) {
+    unsigned char *e = p + len;
+    unsigned char  ch;
+
+    while (p < e) {
+        ch = *p++;
+
+        switch (c->state) {
+
+        case MODES_BEAST_ESCAPE:
+            if (ch == 0x1A) {                   // Doubled 0x1A, so it's data
+                c->frame[c->framepos++] = ch;
+                c->state = MODES_BEAST_DATA;
+                break;
+            }
+            // A single 0x1A inside a frame means the frame was truncated and
+            // this is the start of a new one, so ch is the new frame type
+            c->nDiscarded += c->framepos + 1;
+            c->state = MODES_BEAST_TYPE;
+            // Fall through
+
+        case MODES_BEAST_TYPE:
+            if        (ch == '1') {
+                c->framelen = 8 + MODEAC_MSG_BYTES;
+            } else if (ch == '2') {
+                c->framelen = 8 + MODES_SHORT_MSG_BYTES;
+            } else if (ch == '3') {
+                c->framelen = 8 + MODES_LONG_MSG_BYTES;
+            } else {
+                // Not a frame we know about. A 0x1A here could be the start
+                // of the next frame, anything else means go looking for one
+                if (ch == 0x1A) {
+                    c->nDiscarded++;
+                } else {
+                    c->nDiscarded += 2;
+                    c->state = MODES_BEAST_SYNC;
+                }
+                break;
+            }
+            c->frame[0] = ch;
+            c->framepos = 1;
+            c->state    = MODES_BEAST_DATA;
+            break;
+
+        case MODES_BEAST_DATA:
+            if (ch == 0x1A) {
+                c->state = MODES_BEAST_ESCAPE;
+            } else {
+                c->frame[c->framepos++] = ch;
+            }
+            break;
+
+        default:                                // MODES_BEAST_SYNC
+            if (ch == 0x1A) {
+                c->state = MODES_BEAST_TYPE;
+            } else {
+                c->nDiscarded++;
+            }
+            break;
         }
 
-        if (msgLen == MODEAC_MSG_BYTES) { // ModeA or ModeC
-            decodeModeAMessage(&mm, ((msg[0] << 8) | msg[1]));
-        } else {
-            decodeModesMessage(&mm, msg);
+        if ((c->state == MODES_BEAST_DATA) && (c->framepos == c->framelen)) {
+            c->frame[MODES_FRAME_FEED] = (unsigned char) c->feed;
+            decodeBinMessage(c->frame);
+            c->state = MODES_BEAST_SYNC;
         }
+    }
+}
+//
+//=========================================================================
+//
+// Allocate a client, along with its receive buffer
+//
+struct client *modesCreateClient(void) {
+    struct client *c;
 
-        useModesMessage(&mm);
+    if (Modes.nClientBufSize < MODES_CLIENT_BUF_MIN) {
+        Modes.nClientBufSize = MODES_CLIENT_BUF_MIN;
+    } else if (Modes.nClientBufSize > MODES_CLIENT_BUF_MAX) {
+        Modes.nClientBufSize = MODES_CLIENT_BUF_MAX;
     }
-    return (0);
+
+    if (NULL == (c = (struct client *) calloc(1, sizeof(*c)))) {
+        return (NULL);
+    }
+    if (NULL == (c->buf = (char *) malloc(Modes.nClientBufSize))) {
+        free(c);
+        return (NULL);
+    }
+    c->bufsize = Modes.nClientBufSize;
+    c->state   = MODES_BEAST_SYNC;
+    c->fd      = ANET_ERR;
+    return (c);
+}
+//
+//=========================================================================
+//
+void modesFreeClient(struct client *c) {
+    free(c->buf);
+    free(c);
+}
+//
+//=========================================================================
+//
+// Sample the clock once per read, for everything done with the frames in
+// the buffer. Ages and time windows use the monotonic clock, so stepping
+// the wall clock doesn't upset them. a->seen and the DF history stay on
+// the wall clock, because that's what the uploader compares them with.
+//
+void modesClockUpdate(void) {
+#ifndef _WIN32
+    struct timespec ts;
+
+  #ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  #else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+  #endif
+    __atomic_store_n(&Modes.llNowMs, ((uint64_t) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000), __ATOMIC_RELAXED);
+#else
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    __atomic_store_n(&Modes.llNowMs, ((uint64_t) tv.tv_sec * 1000) + (tv.tv_usec / 1000), __ATOMIC_RELAXED);
+#endif
+    __atomic_store_n(&Modes.tNow, time(NULL), __ATOMIC_RELAXED);
 }
 //
 //=========================================================================
@@ -207,30 +490,25 @@ int decodeBinMessage(char *p) {
 // Every full message received is decoded and passed to the higher layers
 // calling the function's 'handler'.
 //
-// The handler returns 0 on success, or 1 to signal this function we should
-// close the connection with the client in case of non-recoverable errors.
+// If a read fills the buffer there is probably more waiting, so the buffer
+// is doubled (up to MODES_CLIENT_BUF_MAX) and we go round again. Once the
+// buffer has grown to suit the feed, each call drains the socket with a
+// single read.
 //
 void modesReadFromClient(struct client *c) {
     int left;
     int nread;
-    int fullmsg;
     int bContinue = 1;
-    char *s, *e, *p;
+    char *buf;
+    uint64_t llStart;
 
     while(bContinue) {
 
-        fullmsg = 0;
-        left = MODES_CLIENT_BUF_SIZE - c->buflen;
-        // If our buffer is full discard it, this is some badly formatted shit
-        if (left <= 0) {
-            c->buflen = 0;
-            left = MODES_CLIENT_BUF_SIZE;
-            // If there is garbage, read more to discard it ASAP
-        }
+        left = c->bufsize;
 #ifndef _WIN32
-        nread = read(c->fd, c->buf+c->buflen, left);
+        nread = read(c->fd, c->buf, left);
 #else
-        nread = recv(c->fd, c->buf+c->buflen, left, 0);
+        nread = recv(c->fd, c->buf, left, 0);
         if (nread < 0) {errno = WSAGetLastError();}
 #endif
         if (nread == 0) {
@@ -255,66 +533,53 @@ void modesReadFromClient(struct client *c) {
         if (nread <= 0) {
             return;
         }
-        c->buflen += nread;
-
-        // Always null-term so we are free to use strstr() (it won't affect binary case)
-        c->buf[c->buflen] = '\0';
-
-        e = s = c->buf;                                // Start with the start of buffer, first message
-
-        // This is the Beast Binary scanning case.
-        // If there is a complete message still in the buffer, there must be the separator 'sep'
-        // in the buffer, note that we full-scan the buffer at every read for simplicity.
-
-        left = c->buflen;                                  // Length of valid search for memchr()
-        while (left && ((s = memchr(e, (char) 0x1a, left)) != NULL)) { // The first byte of buffer 'should' be 0x1a
-            s++;                                           // skip the 0x1a
-            if        (*s == '1') {
-                e = s + MODEAC_MSG_BYTES      + 8;         // point past remainder of message
-            } else if (*s == '2') {
-                e = s + MODES_SHORT_MSG_BYTES + 8;
-            } else if (*s == '3') {
-                e = s + MODES_LONG_MSG_BYTES  + 8;
-            } else {
-                e = s;                                     // Not a valid beast message, skip
-                left = &(c->buf[c->buflen]) - e;
-                continue;
-            }
-            // we need to be careful of double escape characters in the message body
-            for (p = s; p < e; p++) {
-                if (0x1A == *p) {
-                    p++; e++;
-                    if (e > &(c->buf[c->buflen])) {
-                        break;
-                    }
-                }
-            }
-            left = &(c->buf[c->buflen]) - e;
-            if (left < 0) {                                // Incomplete message in buffer
-                e = s - 1;                                 // point back at last found 0x1a.
-                break;
-            }
-            // Have a 0x1a followed by 1, 2 or 3 - pass message less 0x1a to handler.
-            if (decodeBinMessage(s)) {
-                close(c->fd); 
-                c->fd = ANET_ERR;
-                return;
-            }
-            fullmsg = 1;
+
+        c->nReads++;
+        c->nReadBytes += nread;
+        if (c->nReadMax < nread) {
+            c->nReadMax = nread;
         }
-        s = e;     // For the buffer remainder below
 
-        if (fullmsg) {                             // We processed something - so
-            c->buflen = &(c->buf[c->buflen]) - s;  //     Update the unprocessed buffer length
-            memmove(c->buf, s, c->buflen);         //     Move what's remaining to the start of the buffer
-        } else {                                   // If no message was decoded process the next client
-            break;
+        // Nothing needs better than millisecond resolution, so one clock
+        // read covers everything in the buffer
+        modesClockUpdate();
+        llStart = metricsClock();
+
+        // This is the Beast Binary scanning case. Any partial frame at the end
+        // of the buffer is held in the parser state, so nothing needs moving.
+        modesParseBeast(c, (unsigned char *) c->buf, nread);
+
+        // Hand everything queued from this buffer to the decoder in one go
+        if (Modes.bPipelineRunning) {
+            pipelineFlush();
+        }
+        metricsLatency(&Modes.ReadLatency, llStart);
+
+        // We filled the buffer, so try a bigger one. If we can't get the memory
+        // just carry on with what we have.
+        if ((bContinue) && (c->bufsize < MODES_CLIENT_BUF_MAX)) {
+            if ((buf = (char *) realloc(c->buf, c->bufsize * 2))) {
+                c->buf      = buf;
+                c->bufsize *= 2;
+            }
         }
     }
 }
 //
 //=========================================================================
 //
+// Tell dump1090 whether or not we want Mode A/C in the Beast feed
+//
+void setupBeastFeed(int fd) {
+    if (Modes.mode_ac) {
+        send(fd, "\0321J", 3, 0);
+    } else {
+        send(fd, "\0321j", 3, 0);
+    }
+}
+//
+//=========================================================================
+//
 // Set up data connection
 //
 int setupConnection(void) {
@@ -323,15 +588,357 @@ int setupConnection(void) {
     // Try to connect to the selected ip address and port. We only support *ONE* input connection which we initiate.here.
     fd = anetTcpConnect(Modes.aneterr, ppup1090.net_input_beast_ipaddr, Modes.net_input_beast_port);
     if (fd != ANET_ERR) {
-        if (Modes.mode_ac) {
-            send(fd, "\0321J", 3, 0);
-        } else {
-            send(fd, "\0321j", 3, 0);
-        }
-		//anetNonBlock(Modes.aneterr, fd);
+        setupBeastFeed(fd);
     }
     return (fd);
 }
+#ifndef _WIN32
+//
+// ============================== Event loop ================================
+//
+// Rather than polling, we sleep in epoll_wait() until one of the dump1090
+// sockets has data or a timer fires. The tick timer drives the stale
+// aircraft sweep and the upload once a second, whatever the feeds are
+// doing, and each client has a retry timer which paces its reconnect
+// attempts with an exponential backoff.
+//
+// Each epoll registration carries a tag saying what it is, and for which
+// client or metrics connection.
+//
+#define MODES_EVENT_TICK     0
+#define MODES_EVENT_RETRY    1
+#define MODES_EVENT_CLIENT   2
+#define MODES_EVENT_METRICS  3
+#define MODES_EVENT_SCRAPE   4
+#define MODES_EVENT_TAG(type, n)  (((uint64_t) (type) << 32) | (uint32_t) (n))
+//
+static void eventLoopArmTimer(int fd, int sec, int periodic) {
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = sec;
+    if (periodic) {
+        its.it_interval.tv_sec = sec;
+    }
+    timerfd_settime(fd, 0, &its, NULL);
+}
+//
+//=========================================================================
+//
+static void eventLoopWatch(struct stEventLoop *l, int op, int fd, uint32_t events, uint64_t tag) {
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events   = events;
+    ev.data.u64 = tag;
+    epoll_ctl(l->epfd, op, fd, &ev);
+}
+//
+//=========================================================================
+//
+// Drop the connection to dump1090, if there is one, and arm the retry
+// timer. The wait doubles each time a connect fails, up to a limit.
+//
+static void eventLoopRetry(struct client *c) {
+    if (c->fd != ANET_ERR) {
+        close(c->fd);                   // Also removes it from the epoll set
+        c->fd = ANET_ERR;
+    }
+    c->connecting = 0;
+    eventLoopArmTimer(c->retryfd, c->backoff, 0);
+
+    c->backoff *= 2;
+    if (c->backoff > MODES_RECONNECT_MAX) {
+        c->backoff = MODES_RECONNECT_MAX;
+    }
+}
+//
+//=========================================================================
+//
+// Start a non-blocking connect to dump1090. The socket becomes writable
+// when the connect completes, one way or the other.
+//
+static void eventLoopConnect(struct stEventLoop *l, struct client *c) {
+    struct stFeed *f = &Modes.Feed[c->feed];
+
+    c->fd    = anetTcpNonBlockConnect(Modes.aneterr, f->ipaddr, f->port);
+    c->state = MODES_BEAST_SYNC;
+    if (c->fd == ANET_ERR) {
+        eventLoopRetry(c);
+        return;
+    }
+    c->connecting = 1;
+    eventLoopWatch(l, EPOLL_CTL_ADD, c->fd, EPOLLOUT, MODES_EVENT_TAG(MODES_EVENT_CLIENT, c->feed));
+}
+//
+//=========================================================================
+//
+// The connect has finished, so find out whether it worked
+//
+static void eventLoopConnected(struct stEventLoop *l, struct client *c) {
+    int       err = 0;
+    socklen_t len = sizeof(err);
+
+    if ( (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) || (err) ) {
+        eventLoopRetry(c);
+        return;
+    }
+    c->connecting = 0;
+    c->backoff    = MODES_RECONNECT_MIN;
+    c->nConnects++;
+    setupBeastFeed(c->fd);
+    eventLoopWatch(l, EPOLL_CTL_MOD, c->fd, EPOLLIN, MODES_EVENT_TAG(MODES_EVENT_CLIENT, c->feed));
+}
+//
+//=========================================================================
+//
+// Someone's connected to the metrics port. Wait for their request, and if
+// there are already too many connections, drop the oldest.
+//
+static void eventLoopAcceptScrape(struct stEventLoop *l) {
+    int k  = l->nScrapeNext;
+    int fd = anetTcpAccept(Modes.aneterr, Modes.nMetricsFd, NULL, NULL);
+
+    if (fd == ANET_ERR) {
+        return;
+    }
+    metricsClose(&l->Scrape[k]);
+    anetNonBlock(Modes.aneterr, fd);
+    l->Scrape[k].fd = fd;
+    l->nScrapeNext  = (k + 1) % MODES_METRICS_CLIENTS;
+    eventLoopWatch(l, EPOLL_CTL_ADD, fd, EPOLLIN, MODES_EVENT_TAG(MODES_EVENT_SCRAPE, k));
+}
+//
+//=========================================================================
+//
+// The socket for metrics connection k is ready. If the response doesn't all
+// go at once, stop waiting for the request and wait till the socket can
+// take more.
+//
+static void eventLoopServeScrape(struct stEventLoop *l, int k, uint32_t events, struct client **c, int nClients) {
+    struct stScrape *s = &l->Scrape[k];
+
+    if ((s->fd != -1) && (!metricsServe(s, c, nClients)) && (s->nEnd) && (!(events & EPOLLOUT))) {
+        eventLoopWatch(l, EPOLL_CTL_MOD, s->fd, EPOLLOUT, MODES_EVENT_TAG(MODES_EVENT_SCRAPE, k));
+    }
+}
+//
+//=========================================================================
+//
+// Called each housekeeping tick. Close any metrics connection which hasn't
+// sent its request, or taken any of its response, for MODES_METRICS_TIMEOUT
+// ticks, so a stalled client can't keep a slot.
+//
+static void eventLoopExpireScrapes(struct stEventLoop *l) {
+    int k;
+
+    for (k = 0; k < MODES_METRICS_CLIENTS; k++) {
+        if ((l->Scrape[k].fd != -1) && (++l->Scrape[k].nIdle >= MODES_METRICS_TIMEOUT)) {
+            metricsClose(&l->Scrape[k]);
+        }
+    }
+}
+//
+//=========================================================================
+//
+void modesEventLoop(struct client **c, int nClients) {
+    struct stEventLoop l;
+    struct epoll_event events[2 * MODES_MAX_FEEDS + MODES_METRICS_CLIENTS + 2];
+    struct client *cl;
+    uint64_t expirations;
+    int      j, n;
+
+    memset(&l, 0, sizeof(l));
+    l.epfd    = epoll_create1(0);
+    l.tickfd  = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if ((l.epfd < 0) || (l.tickfd < 0)) {
+        fprintf(stderr, "Error creating event loop : %s\n", strerror(errno));
+        exit(1);
+    }
+    eventLoopWatch(&l, EPOLL_CTL_ADD, l.tickfd, EPOLLIN, MODES_EVENT_TAG(MODES_EVENT_TICK, 0));
+    eventLoopArmTimer(l.tickfd, MODES_HOUSEKEEPING_INTERVAL, 1);
+
+    for (j = 0; j < MODES_METRICS_CLIENTS; j++) {
+        l.Scrape[j].fd = -1;
+    }
+    if (Modes.nMetricsFd != ANET_ERR) {
+        for (j = 0; j < MODES_METRICS_CLIENTS; j++) {
+            if (NULL == (l.Scrape[j].pBuf = (char *) malloc(MODES_METRICS_HEAD_LEN + MODES_METRICS_BUF_LEN))) {
+                fprintf(stderr, "Out of memory allocating metrics buffers.\n");
+                exit(1);
+            }
+        }
+        eventLoopWatch(&l, EPOLL_CTL_ADD, Modes.nMetricsFd, EPOLLIN, MODES_EVENT_TAG(MODES_EVENT_METRICS, 0));
+    }
+
+    for (j = 0; j < nClients; j++) {
+        cl = c[j];
+        cl->backoff = MODES_RECONNECT_MIN;
+        cl->retryfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        if (cl->retryfd < 0) {
+            fprintf(stderr, "Error creating event loop : %s\n", strerror(errno));
+            exit(1);
+        }
+        eventLoopWatch(&l, EPOLL_CTL_ADD, cl->retryfd, EPOLLIN, MODES_EVENT_TAG(MODES_EVENT_RETRY, j));
+        eventLoopConnect(&l, cl);
+    }
+
+    // Keep going till the user does something that stops us. Ctrl/C
+    // interrupts epoll_wait(), so we notice Modes.exit straight away.
+    while (!Modes.exit) {
+        n = epoll_wait(l.epfd, events, 2 * MODES_MAX_FEEDS + MODES_METRICS_CLIENTS + 2, -1);
+        if (n < 0) {
+            if (errno == EINTR) {continue;}
+            fprintf(stderr, "epoll_wait : %s\n", strerror(errno));
+            break;
+        }
+
+        for (j = 0; j < n; j++) {
+            int type = (int) (events[j].data.u64 >> 32);
+
+            if (type == MODES_EVENT_TICK) {
+                if (read(l.tickfd, &expirations, sizeof(expirations)) <= 0) {
+                    continue;
+                }
+                if (Modes.bPipelineRunning) {   // The tracker thread owns the aircraft table
+                    pipelineTick();
+                } else {
+                    interactiveRemoveStaleAircrafts();
+                    postCOAA ();
+                }
+                eventLoopExpireScrapes(&l);
+                continue;
+            }
+
+            if (type == MODES_EVENT_METRICS) {
+                eventLoopAcceptScrape(&l);
+                continue;
+            }
+
+            if (type == MODES_EVENT_SCRAPE) {
+                eventLoopServeScrape(&l, (int) (uint32_t) events[j].data.u64, events[j].events, c, nClients);
+                continue;
+            }
+
+            cl = c[(uint32_t) events[j].data.u64];
+            if (type == MODES_EVENT_RETRY) {
+                if ((read(cl->retryfd, &expirations, sizeof(expirations)) > 0) && (cl->fd == ANET_ERR)) {
+                    eventLoopConnect(&l, cl);
+                }
+
+            } else if (cl->fd != ANET_ERR) {
+                if (cl->connecting) {
+                    eventLoopConnected(&l, cl);
+                } else {
+                    modesReadFromClient(cl);
+                    if (cl->fd == ANET_ERR) {
+                        eventLoopRetry(cl);
+                    }
+                }
+            }
+        }
+    }
+
+    for (j = 0; j < nClients; j++) {
+        close(c[j]->retryfd);
+    }
+    for (j = 0; j < MODES_METRICS_CLIENTS; j++) {
+        metricsClose(&l.Scrape[j]);
+        free(l.Scrape[j].pBuf);
+    }
+    if (Modes.nMetricsFd != ANET_ERR) {
+        close(Modes.nMetricsFd);
+    }
+    close(l.tickfd);
+    close(l.epfd);
+}
+//
+// ================================ Replay ==================================
+//
+// Push a recorded Beast capture through the normal modesReadFromClient()
+// path as fast as we can, and report how long it took.
+//
+// The capture is run three times. The first pass stops each frame after
+// framing, the second after decoding, and the third tracks as normal. The
+// differences give the cost of each stage, without timing individual
+// frames. The ICAO cache is cleared before the final pass, so it sees the
+// capture as if for the first time.
+//
+static uint64_t replayPass(struct client *c, char *pFile, int nStage) {
+    struct timespec t0, t1;
+
+    if ((c->fd = open(pFile, O_RDONLY)) < 0) {
+        fprintf(stderr, "Can't open replay file %s : %s\n", pFile, strerror(errno));
+        exit(1);
+    }
+    c->state           = MODES_BEAST_SYNC;
+    Modes.nReplayStage = nStage;
+    Modes.nFrames      = 0;
+    Modes.nFixed[0]    = Modes.nFixed[1] = Modes.nFixedPositions = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    while ((!Modes.exit) && (c->fd != ANET_ERR)) {
+        modesReadFromClient(c);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    if (c->fd != ANET_ERR) {
+        close(c->fd);
+        c->fd = ANET_ERR;
+    }
+    return (((uint64_t) (t1.tv_sec - t0.tv_sec) * 1000000000) + t1.tv_nsec - t0.tv_nsec);
+}
+//
+//=========================================================================
+//
+void modesReplay(char *pFile) {
+    struct client *c;
+    struct rusage  ru;
+    uint64_t llFrame, llDecode, llTrack, nFrames;
+    double   fFrames;
+
+    if (NULL == (c = modesCreateClient())) {
+        fprintf(stderr, "Out of memory allocating client.\n");
+        exit(1);
+    }
+
+    llFrame  = replayPass(c, pFile, MODES_REPLAY_FRAME);
+    llDecode = replayPass(c, pFile, MODES_REPLAY_DECODE);
+    if (initRecentlySeenICAOAddrs()) {
+        fprintf(stderr, "Out of memory allocating data buffer.\n");
+        exit(1);
+    }
+    llTrack  = replayPass(c, pFile, MODES_REPLAY_TRACK);
+    nFrames  = Modes.nFrames;
+    fFrames  = nFrames ? (double) nFrames : 1.0;
+
+    // Each pass includes the stages before it, so take those off. Timing
+    // noise can make a difference slightly negative, so clamp at 0.
+    llTrack  = (llTrack  > llDecode) ? llTrack  - llDecode : 0;
+    llDecode = (llDecode > llFrame)  ? llDecode - llFrame  : 0;
+
+    getrusage(RUSAGE_SELF, &ru);
+
+    printf("Replay        : %s, %llu bytes, %llu frames\n",
+           pFile, (unsigned long long) (c->nReadBytes / 3), (unsigned long long) nFrames);
+    printf("  read+frame  : %8.1f ns/frame\n", llFrame  / fFrames);
+    printf("  decode      : %8.1f ns/frame\n", llDecode / fFrames);
+    printf("  track       : %8.1f ns/frame\n", llTrack  / fFrames);
+    printf("  total       : %8.1f ns/frame, %.0f frames/s\n",
+           (llFrame + llDecode + llTrack) / fFrames,
+           fFrames * 1e9 / (double) ((llFrame + llDecode + llTrack) ? (llFrame + llDecode + llTrack) : 1));
+    printf("  peak RSS    : %ld kB\n", ru.ru_maxrss);
+    printf("  aircraft    : %u tracked, %u DF's in history\n", interactiveAircraftCount(), Modes.nDFCount);
+    printf("  ICAO cache  : %u addresses, %llu hits, %llu misses\n", Modes.nICAOCount,
+           (unsigned long long) Modes.nICAOHits, (unsigned long long) Modes.nICAOMisses);
+    printf("  bit errors  : %llu frames fixed (%llu one bit, %llu two bit), %llu positions\n",
+           (unsigned long long) (Modes.nFixed[0] + Modes.nFixed[1]),
+           (unsigned long long) Modes.nFixed[0], (unsigned long long) Modes.nFixed[1],
+           (unsigned long long) Modes.nFixedPositions);
+
+    modesFreeClient(c);
+}
+#endif
 //
 // ================================ Main ====================================
 //
@@ -344,7 +951,22 @@ void showHelp(void) {
   "--nomodeac               Disable decoding of SSR Modes 3/A & 3/C\n"
   "--net-bo-ipaddr <IPv4>   TCP Beast output listen IPv4 (default: 127.0.0.1)\n"
   "--net-bo-port <port>     TCP Beast output listen port (default: 30005)\n"
+  "                         Repeat --net-bo-ipaddr to add more feeds (up to "STR(MODES_MAX_FEEDS)"),\n"
+  "                         each --net-bo-port applies to the last --net-bo-ipaddr\n"
+  "--dedup-window <ms>      Drop identical frames from other feeds within this (default: "STR(MODES_DEDUP_WINDOW)")\n"
+  "--fix-bits <n>           Fix up to n bit errors in DF17/18, 0 to 2, 0 turns fixing off (default: "STR(MODES_FIX_BITS)")\n"
+  "                         1 or more also fixes 1 bit errors in DF11 from recently seen addresses\n"
   "--net-pp-ipaddr <IPv4>   Plane Plotter LAN IPv4 Address (default: 0.0.0.0)\n"
+  "--net-buffer <bytes>     Initial Beast receive buffer size (default: "STR(MODES_CLIENT_BUF_SIZE)")\n"
+  "--aircraft-pool <n>      Aircraft records to preallocate (default: "STR(MODES_AIRCRAFT_POOL_LEN)")\n"
+  "--df-history <n>         Length of the DF history ring (default: "STR(MODES_DF_HISTORY_LEN)")\n"
+  "                         Make it the peak DF's a second times "STR(MODES_INTERACTIVE_DELETE_TTL)" or more\n"
+  "--no-pipeline            Decode and track on the main thread, e.g. on single core systems\n"
+  "--decode-queue <n>       Frames queued for the decoder thread (default: "STR(MODES_DECODE_RING_LEN)")\n"
+  "--shards <n>             Split tracking across n threads, up to "STR(MODES_MAX_SHARDS)" (default: 1)\n"
+  "--metrics-port <port>    Serve Prometheus metrics at /metrics on this port (default: off)\n"
+  "--metrics-ipaddr <IPv4>  Address to serve the metrics on (default: 127.0.0.1)\n"
+  "--replay <file>          Decode a recorded Beast capture as fast as possible, report timings and exit\n"
   "--quiet                  Disable output to stdout. Use for daemon applications\n"
   "--help                   Show this help\n"
     );
@@ -390,7 +1012,9 @@ void showCopyright(void) {
 //
 int main(int argc, char **argv) {
     int j;
-    struct client *c;
+    int bFeedAddr = 0;                 // Set once the first feed has been given an address
+    struct client *c[MODES_MAX_FEEDS];
+    struct client *cl;
 
     // Set sane defaults
 
@@ -406,11 +1030,46 @@ int main(int argc, char **argv) {
         } else if (!strcmp(argv[j],"--nomodeac")) {
             Modes.mode_ac = 0;
         } else if (!strcmp(argv[j],"--net-bo-port") && more) {
-            Modes.net_input_beast_port = atoi(argv[++j]);
+            Modes.Feed[Modes.nFeeds - 1].port = atoi(argv[++j]);
         } else if (!strcmp(argv[j],"--net-bo-ipaddr") && more) {
-            strcpy(ppup1090.net_input_beast_ipaddr, argv[++j]);
+            // The first address replaces the default feed, any more add feeds
+            if (bFeedAddr) {
+                if (Modes.nFeeds == MODES_MAX_FEEDS) {
+                    fprintf(stderr, "Too many Beast input feeds, the limit is %d.\n", MODES_MAX_FEEDS);
+                    exit(1);
+                }
+                Modes.Feed[Modes.nFeeds++].port = MODES_NET_OUTPUT_BEAST_PORT;
+            }
+            strncpy(Modes.Feed[Modes.nFeeds - 1].ipaddr, argv[++j], sizeof(Modes.Feed[0].ipaddr) - 1);
+            bFeedAddr = 1;
+        } else if (!strcmp(argv[j],"--dedup-window") && more) {
+            Modes.nDedupWindow = atoi(argv[++j]);
+        } else if (!strcmp(argv[j],"--fix-bits") && more) {
+            Modes.nFixBits = atoi(argv[++j]);
+            if ((Modes.nFixBits < 0) || (Modes.nFixBits > 2)) {
+                fprintf(stderr, "--fix-bits must be 0, 1 or 2.\n");
+                exit(1);
+            }
         } else if (!strcmp(argv[j],"--net-pp-ipaddr") && more) {
             inet_aton(argv[++j], (void *)&ppup1090.net_pp_ipaddr);
+        } else if (!strcmp(argv[j],"--net-buffer") && more) {
+            Modes.nClientBufSize = atoi(argv[++j]);
+        } else if (!strcmp(argv[j],"--aircraft-pool") && more) {
+            Modes.nAircraftPool = atoi(argv[++j]);
+        } else if (!strcmp(argv[j],"--df-history") && more) {
+            Modes.nDFHistory = atoi(argv[++j]);
+        } else if (!strcmp(argv[j],"--no-pipeline")) {
+            Modes.bPipeline = 0;
+        } else if (!strcmp(argv[j],"--decode-queue") && more) {
+            Modes.nDecodeRing = atoi(argv[++j]);
+        } else if (!strcmp(argv[j],"--shards") && more) {
+            Modes.nShards = atoi(argv[++j]);
+        } else if (!strcmp(argv[j],"--metrics-port") && more) {
+            Modes.nMetricsPort = atoi(argv[++j]);
+        } else if (!strcmp(argv[j],"--metrics-ipaddr") && more) {
+            strncpy(Modes.szMetricsAddr, argv[++j], sizeof(Modes.szMetricsAddr) - 1);
+        } else if (!strcmp(argv[j],"--replay") && more) {
+            Modes.pReplayFile = argv[++j];
         } else if (!strcmp(argv[j],"--quiet")) {
             ppup1090.quiet = 1;
         } else if (!strcmp(argv[j],"--help")) {
@@ -428,37 +1087,114 @@ int main(int argc, char **argv) {
     if (!ppup1090.quiet) {showCopyright();}
 #endif
 
+    // Feed[0] is also known by its original names
+    strcpy(ppup1090.net_input_beast_ipaddr, Modes.Feed[0].ipaddr);
+    Modes.net_input_beast_port = Modes.Feed[0].port;
+
     // Initialization
     ppup1090Init();
 
-    c = (struct client *) malloc(sizeof(*c));
-    c->buflen = 0;
-    c->fd     = setupConnection();
+    if (Modes.pReplayFile) {
+#ifndef _WIN32
+        modesReplay(Modes.pReplayFile);
+#else
+        fprintf(stderr, "--replay is not supported on Windows.\n");
+#endif
+        closeCOAA ();
+        return (0);
+    }
+
+    for (j = 0; j < Modes.nFeeds; j++) {
+        if (NULL == (c[j] = modesCreateClient())) {
+            fprintf(stderr, "Out of memory allocating client.\n");
+            exit(1);
+        }
+        c[j]->feed = j;
+    }
+
+#ifndef _WIN32
+    if (metricsInit()) {
+        exit(1);
+    }
+    if ((Modes.bPipeline) && (pipelineStart())) {
+        fprintf(stderr, "Error starting the decode pipeline threads.\n");
+        exit(1);
+    }
+    modesEventLoop(c, Modes.nFeeds);
+    pipelineDrain();                   // Don't lose the frames still queued
+    pipelineStop();
+#else
+    cl        = c[0];
+    cl->fd    = setupConnection();
 
     // Keep going till the user does something that stops us
     while (!Modes.exit) {
         interactiveRemoveStaleAircrafts();
         postCOAA ();
 
-        if (c->fd == ANET_ERR) {
+        if (cl->fd == ANET_ERR) {
             // If the connection to dump1090 has failed, wait 1 second before trying to re-connect 
 			usleep(1000000);
 
             // Try to connect to the selected ip address and port. We only support *ONE* input connection 
             // which we try to initiate here.
-            c->fd     = setupConnection();
-            c->buflen = 0;
+            cl->fd    = setupConnection();
+            cl->state = MODES_BEAST_SYNC;
 
        } else {
             // If the connecton to dupp1090 is up and running, try to read some data.
-            modesReadFromClient(c);
+            modesReadFromClient(cl);
        }
     }
+#endif
 
     // The user has stopped us, so close any socket we opened
-    if (c->fd != ANET_ERR)
-      {close(c->fd);}
-    free(c);
+    for (j = 0; j < Modes.nFeeds; j++) {
+        cl = c[j];
+        if (cl->fd != ANET_ERR)
+          {close(cl->fd);}
+
+        if (!ppup1090.quiet) {
+            printf("Network input : %s:%d, %llu reads, %llu bytes, %llu average, %d max per read, %llu discarded, buffer %d bytes\n",
+                   Modes.Feed[j].ipaddr, Modes.Feed[j].port,
+                   (unsigned long long) cl->nReads, (unsigned long long) cl->nReadBytes,
+                   (unsigned long long) (cl->nReads ? cl->nReadBytes / cl->nReads : 0),
+                   cl->nReadMax, (unsigned long long) cl->nDiscarded, cl->bufsize);
+        }
+    }
+
+    if (!ppup1090.quiet) {
+        if (Modes.bPipeline) {
+            printf("Decode queue  : %u slots, high water %u, %llu frames, %llu dropped\n",
+                   Modes.DecodeRing.nSize, Modes.DecodeRing.nHighWater,
+                   (unsigned long long) Modes.DecodeRing.nPushed, (unsigned long long) Modes.DecodeRing.nDropped);
+            for (j = 0; j < Modes.nShards; j++) {
+                printf("Track queue %-2d: %u slots, high water %u, %llu messages\n", j,
+                       Modes.pShards[j].Ring.nSize, Modes.pShards[j].Ring.nHighWater,
+                       (unsigned long long) Modes.pShards[j].Ring.nPushed);
+            }
+        }
+        if (Modes.pDedup) {
+            printf("Duplicates    : %llu frames dropped\n", (unsigned long long) Modes.nDedupDropped);
+        }
+        printf("ICAO cache    : %u addresses, %llu hits, %llu misses\n", Modes.nICAOCount,
+               (unsigned long long) Modes.nICAOHits, (unsigned long long) Modes.nICAOMisses);
+        printf("Bit errors    : %llu frames fixed (%llu one bit, %llu two bit), %llu positions, %.2f positions/s\n",
+               (unsigned long long) (Modes.nFixed[0] + Modes.nFixed[1]),
+               (unsigned long long) Modes.nFixed[0], (unsigned long long) Modes.nFixed[1],
+               (unsigned long long) Modes.nFixedPositions,
+               (double) Modes.nFixedPositions / (double) ((time(NULL) > Modes.tStart) ? (time(NULL) - Modes.tStart) : 1));
+        for (j = 0; j < Modes.nShards; j++) {
+            printf("Aircraft pool : shard %d, %u records, %u in use, high water %u\n", j,
+                   Modes.pShards[j].AircraftPool.nTotal, Modes.pShards[j].AircraftPool.nUsed,
+                   Modes.pShards[j].AircraftPool.nHighWater);
+        }
+        printf("DF history    : %d records, %u in use, high water %u, %u overwritten before expiry\n",
+               Modes.nDFHistory, Modes.nDFCount, Modes.nDFHighWater, Modes.nDFOverwritten);
+    }
+    for (j = 0; j < Modes.nFeeds; j++) {
+        modesFreeClient(c[j]);
+    }
 
     closeCOAA ();
 #ifndef _WIN32
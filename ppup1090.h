@@ -60,6 +60,9 @@
     #include <ctype.h>
     #include <sys/stat.h>
     #include <sys/ioctl.h>
+    #include <sys/epoll.h>
+    #include <sys/timerfd.h>
+    #include <sys/resource.h>
     #include "anet.h"
     #include <netdb.h>
 #else
@@ -94,8 +97,10 @@
 #define MODES_LONG_MSG_BITS     (MODES_LONG_MSG_BYTES    * 8)
 #define MODES_SHORT_MSG_BITS    (MODES_SHORT_MSG_BYTES   * 8)
 
-#define MODES_ICAO_CACHE_LEN 1024 // Power of two required
+#define MODES_ICAO_CACHE_LEN (1 << 24) // One entry for every ICAO address
 #define MODES_ICAO_CACHE_TTL 60   // Time to live of cached addresses
+#define MODES_ICAO_CACHE_TICK 4   // Seconds per tick of the cached timestamps
+#define MODES_ICAO_SWEEP_LEN (MODES_ICAO_CACHE_LEN / 128) // Entries checked for expiry each second
 #define MODES_UNIT_FEET 0
 #define MODES_UNIT_METERS 1
 
@@ -124,9 +129,87 @@
 
 #define MODES_INTERACTIVE_DELETE_TTL   300      // Delete from the list after 300 seconds
 #define MODES_INTERACTIVE_DISPLAY_TTL   60      // Delete from display after 60 seconds
+#define MODES_CPR_PAIR_MS            10000      // Most time between odd and even CPR positions for a global decode
+
+#define MODES_AIRCRAFT_HASH_LEN       1024      // Initial aircraft table size, power of two required
+#define MODES_AIRCRAFT_POOL_LEN       1024      // Default number of aircraft records to preallocate
+#define MODES_DF_HISTORY_LEN        131072      // Default length of the DF history ring, 437 DFs/s over the delete TTL
+#define MODES_POOL_SLAB_LEN           1024      // Records added each time a pool runs dry
+#define MODES_SQUAWK_INDEX_LEN        4096      // One bucket for every possible squawk
+#define MODES_ALTITUDE_INDEX_LEN      2048      // Mode C altitude buckets, power of two required
+#define MODES_WHEEL_BITS                 6      // Each level of the expiry wheel has 1 << MODES_WHEEL_BITS slots
+#define MODES_WHEEL_LEN       (1 << MODES_WHEEL_BITS)
+#define MODES_WHEEL_MASK      (MODES_WHEEL_LEN - 1)
+
+// The clock sampled by modesClockUpdate()
+#define MODES_NOW_MS()   __atomic_load_n(&Modes.llNowMs, __ATOMIC_RELAXED)
+#define MODES_NOW()      __atomic_load_n(&Modes.tNow,    __ATOMIC_RELAXED)
+
+// Counters the metrics scrape reads from another thread. Each one is only
+// ever changed by one thread, so a relaxed store will do for that, and
+// there's no locked add.
+#define MODES_COUNT(x, n)  __atomic_store_n(&(x), (x) + (n), __ATOMIC_RELAXED)
+#define MODES_COUNTER(x)   __atomic_load_n(&(x), __ATOMIC_RELAXED)
+
+// The lists each aircraft can be on, see struct aircraft
+#define MODES_INDEX_SQUAWK   0 // Mode A/C correlation, by squawk
+#define MODES_INDEX_ALTITUDE 1 // Mode A/C correlation, by Mode C altitude
+#define MODES_INDEX_EXPIRY   2 // Expiry wheel slot
+#define MODES_INDEXES        3
 
 #define MODES_NET_OUTPUT_BEAST_PORT 30005
-#define MODES_CLIENT_BUF_SIZE  1024
+#define MODES_CLIENT_BUF_SIZE  65536    // Default receive buffer size
+#define MODES_CLIENT_BUF_MIN   1024     // Smallest receive buffer we'll accept
+#define MODES_CLIENT_BUF_MAX   1048576  // Receive buffer never grows beyond this
+
+// A Beast frame, once un-escaped, is a type byte, a 6 byte timestamp, a signal
+// level byte and up to MODES_LONG_MSG_BYTES of message
+#define MODES_BEAST_FRAME_BYTES (1 + 6 + 1 + MODES_LONG_MSG_BYTES)
+
+// The index of the feed a frame came from is kept in the byte after it, so
+// frames are passed around and queued with one extra byte
+#define MODES_FRAME_FEED        MODES_BEAST_FRAME_BYTES
+#define MODES_FRAME_BYTES      (MODES_BEAST_FRAME_BYTES + 1)
+
+// Beast timestamps are a 48 bit count of the receivers 12 MHz clock
+#define MODES_TIMESTAMP_MASK    ((1ULL << 48) - 1)
+#define MODES_TIMESTAMP_PER_MS  12000
+
+// Beast parser states
+#define MODES_BEAST_SYNC        0 // Waiting for the 0x1A which starts a frame
+#define MODES_BEAST_TYPE        1 // Had the 0x1A, waiting for the frame type
+#define MODES_BEAST_DATA        2 // Collecting the frame body
+#define MODES_BEAST_ESCAPE      3 // Had a 0x1A in the frame body, waiting to see if it's doubled
+
+#define MODES_HOUSEKEEPING_INTERVAL  1    // Seconds between stale aircraft sweeps and uploads
+#define MODES_RECONNECT_MIN          1    // Seconds to wait before the first reconnect attempt
+#define MODES_RECONNECT_MAX         32    // Reconnect backoff doubles up to this many seconds
+
+#define MODES_MAX_FEEDS              8    // Most Beast input feeds we'll connect to
+#define MODES_DEDUP_LEN          16384    // Slots in the duplicate frame table, power of two required
+#define MODES_DEDUP_PROBE            8    // Slots searched for a duplicate before giving up
+#define MODES_DEDUP_WINDOW         250    // Default milliseconds an identical frame counts as a duplicate
+#define MODES_FIX_BITS               1    // Default most bit errors fixed in a DF17/18, 0 to 2
+
+// How far decodeBinMessage() takes each frame. Replay uses the shorter
+// stages to time framing and decoding on their own.
+#define MODES_REPLAY_TRACK           0    // Frame, decode and track (normal operation)
+#define MODES_REPLAY_FRAME           1    // Frame only
+#define MODES_REPLAY_DECODE          2    // Frame and decode
+
+#define MODES_DECODE_RING_LEN    65536    // Frames queued for the decoder, power of two required
+#define MODES_TRACK_RING_LEN      4096    // Messages queued for each shard, power of two required
+#define MODES_PIPELINE_BATCH       256    // Messages a shard takes between housekeeping checks
+#define MODES_DECODE_BATCH         256    // Frames decodeModesBatch() works on at a time
+#define MODES_MAX_SHARDS            16    // Most tracker shards we'll run
+
+#define MODES_METRICS_PORT           0    // Default metrics port, 0 means no metrics endpoint
+#define MODES_METRICS_CLIENTS        4    // Most metrics scrapes we'll have open at once
+#define MODES_METRICS_BUF_LEN    32768    // Room for the metrics response body
+#define MODES_METRICS_HEAD_LEN     256    // Room for the HTTP header in front of it
+#define MODES_METRICS_REQ_LEN     1024    // Room for the start of the HTTP request
+#define MODES_METRICS_TIMEOUT        5    // Housekeeping ticks a metrics connection may go without progress
+#define MODES_LATENCY_BUCKETS       16    // Latency histogram buckets, 1us doubling to 32ms, plus one for longer
 
 #define PPUP1090_NET_OUTPUT_IP_ADDRESS "127.0.0.1"
 
@@ -139,9 +222,107 @@
 
 // Structure used to describe a networking client
 struct client {
-    int    fd;                           // File descriptor
-    int    buflen;                       // Amount of data in buffer
-    char   buf[MODES_CLIENT_BUF_SIZE+1]; // Read buffer
+    int           fd;                               // File descriptor
+    int           feed;                             // Index of this clients feed in Modes.Feed
+    int           retryfd;                          // timerfd for the reconnect backoff
+    int           backoff;                          // Seconds to wait before the next reconnect attempt
+    int           connecting;                       // Non-zero while a connect is in progress
+    int           state;                            // Beast parser state
+    int           framepos;                         // Bytes of the current frame collected so far
+    int           framelen;                         // Total bytes in the current frame
+    unsigned char frame[MODES_FRAME_BYTES];         // Current frame, un-escaped, then the feed index
+    char         *buf;                              // Read buffer
+    int           bufsize;                          // Size of the read buffer
+
+    // Statistics
+    uint64_t      nReads;                           // Number of reads which returned data
+    uint64_t      nReadBytes;                       // Bytes returned by those reads
+    uint64_t      nDiscarded;                       // Bytes thrown away while looking for a frame
+    int           nReadMax;                         // Most bytes returned by a single read
+    uint64_t      nConnects;                        // Connections made to the feed
+};
+
+// A Beast input feed
+struct stFeed {
+    char   ipaddr[32];              // IPv4 address or network name of the dump1090 instance
+    int    port;                    // Beast output port of the dump1090 instance
+};
+
+// A metrics connection, from accept till its response has all been written.
+// The request gathers in szReq till its first line is complete. The
+// response is built in pBuf, and nPos moves up to nEnd as the socket
+// takes it.
+struct stScrape {
+    int    fd;                      // Socket, -1 if the slot is free
+    int    nIdle;                   // Housekeeping ticks since it last made progress
+    int    nReq;                    // Bytes of the request in szReq
+    char   szReq[MODES_METRICS_REQ_LEN]; // The request so far, zero terminated
+    int    nPos;                    // Next byte of pBuf to write
+    int    nEnd;                    // End of the response in pBuf, 0 till the request arrives
+    char  *pBuf;                    // MODES_METRICS_HEAD_LEN + MODES_METRICS_BUF_LEN bytes
+};
+
+// Event loop state. The loop waits on the client sockets, a timer for the
+// housekeeping tick, a reconnect timer for each client, and the metrics
+// endpoint.
+struct stEventLoop {
+    int    epfd;                    // epoll instance
+    int    tickfd;                  // timerfd for the housekeeping tick
+    struct stScrape Scrape[MODES_METRICS_CLIENTS]; // Metrics connections
+    int    nScrapeNext;             // The Scrape slot the next connection goes in
+};
+
+// A histogram of how long something took, see metricsLatency(). Only ever
+// changed by one thread.
+struct stLatency {
+    uint64_t nBucket[MODES_LATENCY_BUCKETS + 1]; // nBucket[k] counts times under 2^k us which weren't in an earlier bucket
+    uint64_t llSumNs;                            // Total time, in nanoseconds
+};
+
+// An identical Mode S frame from another feed within the de-duplication
+// window is dropped. Entries are never deleted, they just age out.
+struct stDedupEntry {
+    uint64_t      llSeen;                     // Milliseconds when this frame was last accepted
+    uint32_t      hash;                       // Hash of the frame bytes
+    int           len;                        // Frame length in bytes, 0 if the slot is unused
+    int           feed;                       // Index of the feed it was accepted from
+    unsigned char msg[MODES_LONG_MSG_BYTES];  // The frame
+};
+
+// Single producer, single consumer ring of fixed size items. Only the
+// producer writes nHead and only the consumer writes nTail, so items are
+// passed without locks. Each side keeps a copy of the other's index, and
+// only re-reads it when the ring looks full or empty. A consumer with
+// nothing to do sleeps on the cond, and the producer wakes it. The padding
+// keeps the two sides on separate cache lines.
+struct stRing {
+    unsigned char   *pItems;        // nSize items of nItemSize bytes
+    size_t           nItemSize;     // Size of each item
+    uint32_t         nSize;         // Number of items, always a power of two
+    pthread_mutex_t  mutex;         // Only used to sleep and wake the consumer
+    pthread_cond_t   cond;
+    int              bSleeping;     // Consumer is, or is about to be, asleep
+
+    // Producer side
+    char             cPad1[64];
+    uint32_t         nFill;         // Next slot to fill
+    uint32_t         nHead;         // Slots before this have been published to the consumer
+    uint32_t         nTailCache;    // Producers copy of nTail
+    uint32_t         nHighWater;    // Deepest the ring has been
+    uint64_t         nPushed;       // Items published
+    uint64_t         nDropped;      // Items the producer had to throw away because the ring was full
+
+    // Consumer side
+    char             cPad2[64];
+    uint32_t         nTail;         // Next slot to take
+    uint32_t         nHeadCache;    // Consumers copy of nHead
+    char             cPad3[64];
+};
+
+// Link in one of a shards lists of aircraft
+struct stIndexLink {
+    struct aircraft  *pNext;      // Next aircraft in this bucket
+    struct aircraft **ppPrev;     // Whatever points at us, NULL if we're not on the list
 };
 
 // Structure used to describe an aircraft in iteractive mode
@@ -174,6 +355,90 @@ struct aircraft {
     double        lat, lon;       // Coordinated obtained from CPR encoded data
     int           bFlags;         // Flags related to valid fields in this structure
     struct aircraft *next;        // Next aircraft in our linked list
+
+    // Everything above is laid out for the uploader, so our own bookkeeping
+    // goes on the end. The fields every message looks at come first, next
+    // to bFlags, so the index links after them are only touched when an
+    // aircraft actually moves.
+    uint32_t           nListPos;  // Where we are in our shards pAircraftList
+    uint32_t           nIndexed;  // Bit k is set while we're in index k
+
+    // Mode S aircraft are indexed on squawk and Mode C altitude, so a Mode A/C
+    // code can be matched against them without searching every aircraft.
+    // Every aircraft is also in a slot of its shards expiry wheel.
+    struct stIndexLink Index[MODES_INDEXES];
+
+    // The last E/W and N/S velocities we had, and the speed and track they
+    // gave, so a repeat doesn't have to be worked out again
+    int                nLastEW;
+    int                nLastNS;
+    int                nLastSpeed;
+    int                nLastTrack;
+
+    // The Beast timestamps of the odd and even CPR positions, with the feed
+    // they came from above bit 48, see interactiveCPRPaired()
+    uint64_t           llOddCPRStamp;
+    uint64_t           llEvenCPRStamp;
+};
+
+// Open addressing (linear probe) hash table keyed on the 24 bit ICAO address.
+// Deletion shifts entries back rather than leaving tombstones, so lookups
+// never have to skip over dead slots.
+struct stICAOHashEntry {
+    uint32_t  addr;               // ICAO address
+    void     *pData;              // Data for this address, NULL if the slot is empty
+};
+
+struct stICAOHash {
+    uint32_t                nSize;  // Number of slots, always a power of two
+    uint32_t                nCount; // Number of occupied slots
+    struct stICAOHashEntry *pSlot;  // The slots
+};
+
+// Fixed size record pool. Records are carved out of slabs and recycled
+// through a free list, so once allocated they are never handed back to
+// malloc. This avoids allocator churn and fragmentation on small systems.
+struct stPoolSlab {
+    struct stPoolSlab *pNext;     // Next slab in this pool
+    double             fAlign;    // Force the records that follow to be 8 byte aligned
+};
+
+struct stPool {
+    size_t             nItemSize; // Size of each record, rounded up to 8 bytes
+    void              *pFree;     // Free list, linked through the first word of each free record
+    struct stPoolSlab *pSlab;     // Slabs allocated to this pool
+    uint32_t           nTotal;    // Number of records in all slabs
+    uint32_t           nUsed;     // Number of records currently allocated
+    uint32_t           nHighWater;// Highest value nUsed has reached
+};
+
+// The aircraft table is split into shards by ICAO address. Each shard has
+// its own records, and when the pipeline is running its own tracker thread,
+// so only that thread ever changes them. Mode A/C codes are tracked under a
+// made up address, so they're spread across the shards the same way.
+struct stShard {
+    // Tracker thread, see pipeline.c
+    struct stRing      Ring;            // Decoded messages for this shard, decoder -> tracker
+    pthread_t          thread;
+    uint32_t           nTicksDone;      // Housekeeping ticks the tracker has run, see Modes.nTicks
+    uint64_t           nDone;           // Messages the tracker has finished with
+    struct stLatency   TrackLatency;    // Time taken to track each batch
+
+    // Aircraft table
+    struct aircraft  **pAircraftList;   // Dense array of tracked aircraft
+    uint32_t           nAircraft;       // Number of aircraft in pAircraftList
+    uint32_t           nAircraftSize;   // Allocated length of pAircraftList
+    struct stICAOHash  AircraftHash;    // ICAO address -> aircraft
+    struct stPool      AircraftPool;    // Aircraft records
+
+    // Mode A/C correlation indexes, only Mode S aircraft are in them
+    struct aircraft   *pSquawkIndex[MODES_SQUAWK_INDEX_LEN];     // Squawk -> aircraft
+    struct aircraft   *pAltitudeIndex[MODES_ALTITUDE_INDEX_LEN]; // Mode C altitude -> aircraft
+
+    // Expiry timing wheel. Level 0 has a slot for each of the next MODES_WHEEL_LEN
+    // seconds, level 1 a slot for each of the following blocks of MODES_WHEEL_LEN seconds.
+    struct aircraft   *pWheel[2][MODES_WHEEL_LEN];
+    time_t             tWheel;          // The last second the wheel has been turned to
 };
 
 struct stDF {
@@ -192,7 +457,7 @@ struct {                             // Internal state
 
     pthread_mutex_t data_mutex;      // Mutex to synchronize buffer access
     pthread_cond_t  data_cond;       // Conditional variable associated
-    uint32_t       *icao_cache;      // Recently seen ICAO addresses cache
+    uint8_t        *icao_cache;      // Recently seen ICAO addresses, a coarse timestamp for each address
     int             exit;            // Exit from the main loop when true
 
     // Networking
@@ -222,46 +487,132 @@ struct {                             // Internal state
     // DF List mode
     pthread_mutex_t pDF_mutex;        // Mutex to synchronize pDF access
     struct stDF    *pDF;              // Pointer to DF list
+
+    // Everything above here is also used by the uploader object, so new
+    // fields must only ever be added below this point.
+
+    // Aircraft table. Modes.aircrafts (above) is threaded through every
+    // shard by interactiveLinkAircraft(), just before each postCOAA().
+    int                nShards;         // Number of shards
+    struct stShard    *pShards;         // The shards
+    pthread_barrier_t  ShardBarrier;    // Housekeeping rendezvous for the shard trackers
+
+    // DF list index, protected by pDF_mutex like the list itself
+    struct stICAOHash  DFHash;          // ICAO address -> newest DF for that address
+
+    // Networking. Feed[0] is mirrored in ppup1090.net_input_beast_ipaddr
+    // and Modes.net_input_beast_port, which are what the Windows build uses.
+    int                nClientBufSize;  // Initial size of the client receive buffer
+    int                nFeeds;          // Number of Beast input feeds
+    struct stFeed      Feed[MODES_MAX_FEEDS];
+
+    // Duplicate frame suppression, only used when there's more than one feed
+    int                nDedupWindow;    // Milliseconds an identical frame counts as a duplicate
+    struct stDedupEntry *pDedup;        // MODES_DEDUP_LEN slots
+    uint64_t           nDedupDropped;   // Frames dropped as duplicates
+    uint64_t           nFrames;         // Beast frames passed to decodeBinMessage()
+
+    // Decode pipeline, see pipeline.c
+    int                bPipeline;       // Run the decoder and trackers on their own threads
+    int                nDecodeRing;     // Frames the decode ring holds, rounded up to a power of two
+    int                bPipelineRunning;// The pipeline threads have been started
+    int                bPipelineStop;   // Tells the pipeline threads to finish
+    pthread_t          decoder_thread;
+    struct stRing      DecodeRing;      // Un-escaped frames, reader -> decoder
+    uint64_t           nDecodeDone;     // Frames the decoder has finished with
+    uint32_t           nTicks;          // Housekeeping ticks the reader has asked the trackers for
+
+    // Replay of a recorded Beast capture
+    char              *pReplayFile;     // Capture to replay, NULL for normal operation
+    int                nReplayStage;    // MODES_REPLAY_TRACK, MODES_REPLAY_FRAME or MODES_REPLAY_DECODE
+
+    // Record pools
+    int                nAircraftPool;   // Number of aircraft records to preallocate, across all shards
+
+    // DF history ring. Modes.pDF (above) is the newest entry, and the pNext
+    // and pPrev pointers thread the list through the ring, newest to oldest.
+    // Protected by pDF_mutex.
+    int                nDFHistory;      // Length of the ring
+    struct stDF       *pDFRing;         // The ring itself
+    uint32_t           nDFHead;         // Ring index the next DF will be written to
+    uint32_t           nDFCount;        // Number of DF's in the ring
+    uint32_t           nDFHighWater;    // Highest value nDFCount has reached
+    uint32_t           nDFOverwritten;  // DF's dropped before they expired because the ring was full
+
+    // Bit error correction, see fixBitErrors(). Only the decoder changes the counts.
+    int                nFixBits;        // Most bit errors to fix in a DF17/18, 0 turns fixing off, a DF11 gets at most 1
+    uint64_t           nFixed[2];       // Frames fixed with one, and with two, bit errors
+    uint64_t           nFixedPositions; // DF17/18 position squitters among them
+    time_t             tStart;          // When we started, to work out rates
+
+    // The clock, sampled once per read by modesClockUpdate(). Read it with
+    // MODES_NOW_MS() and MODES_NOW(), as other threads may be updating it.
+    uint64_t           llNowMs;         // Monotonic milliseconds, for ages and time windows
+    time_t             tNow;            // Wall clock seconds, for anything the uploader sees
+
+    // Recently seen ICAO addresses, see addRecentlySeenICAOAddr(). Only the decoder changes these.
+    uint32_t           nICAOCount;      // Addresses in icao_cache, including expired ones not yet swept
+    uint64_t           nICAOHits;       // Lookups which found a recently seen address
+    uint64_t           nICAOMisses;     // Lookups which didn't
+    time_t             tICAOSweep;      // The last second part of icao_cache was swept
+    uint32_t           nICAOSweep;      // Where the next sweep starts
+
+    // Metrics endpoint, see metrics.c. Counters belong to the thread which
+    // changes them, and the scrape adds them up.
+    int                nMetricsPort;    // Port to serve metrics on, 0 for none
+    char               szMetricsAddr[32]; // Address to serve metrics on
+    int                nMetricsFd;      // Listening socket, ANET_ERR if none
+    uint64_t           nBadCRC;         // Mode S frames with a bad CRC (decoder)
+    struct stLatency   ReadLatency;     // Time taken to handle each read (reader)
+    struct stLatency   DecodeLatency;   // Time taken to decode each batch (decoder)
+    uint32_t           nMetricAircraft; // Aircraft tracked, as of the last housekeeping
 } Modes;
 
 // The struct we use to store information about a decoded message.
+//
+// Every frame gets one of these, and it's copied through the decode pipeline,
+// so it's kept small. The fields are ordered by size so there's no padding,
+// and the ones with only a few possible values are bytes.
+//
 struct modesMessage {
     // Generic fields
-    unsigned char msg[MODES_LONG_MSG_BYTES];      // Binary message.
-    int           msgbits;                        // Number of bits in message 
-    int           msgtype;                        // Downlink format #
-    int           crcok;                          // True if CRC was valid
+    uint64_t      timestampMsg;                   // Timestamp of the message
     uint32_t      crc;                            // Message CRC
     uint32_t      addr;                           // ICAO Address from bytes 1 2 and 3
-    uint64_t      timestampMsg;                   // Timestamp of the message
-    unsigned char signalLevel;                    // Signal Amplitude
 
     // DF 11
-    int  ca;                    // Responder capabilities
-    int  iid;
+    uint32_t iid;
 
     // DF 17, DF 18
-    int    metype;              // Extended squitter message type.
-    int    mesub;               // Extended squitter message subtype.
-    int    heading;             // Reported by aircraft, or computed from from EW and NS velocity
-    int    raw_latitude;        // Non decoded latitude.
-    int    raw_longitude;       // Non decoded longitude.
     double fLat;                // Coordinates obtained from CPR encoded data if/when decoded
     double fLon;                // Coordinates obtained from CPR encoded data if/when decoded
-    char   flight[16];          // 8 chars flight number.
+    int    heading;             // Reported by aircraft, or see decodeModesVelocity()
+    int    velocity;            // Reported by aircraft, or see decodeModesVelocity()
     int    ew_velocity;         // E/W velocity.
     int    ns_velocity;         // N/S velocity.
     int    vert_rate;           // Vertical rate.
-    int    velocity;            // Reported by aircraft, or computed from from EW and NS velocity
+    int    raw_latitude;        // Non decoded latitude.
+    int    raw_longitude;       // Non decoded longitude.
 
     // DF4, DF5, DF20, DF21
-    int  fs;                    // Flight status for DF4,5,20,21
     int  modeA;                 // 13 bits identity (Squawk).
 
     // Fields used by multiple message types.
     int  altitude;
     int  unit; 
     int  bFlags;                // Flags related to fields in this structure
+
+    char          flight[16];                     // 8 chars flight number.
+    unsigned char msg[MODES_LONG_MSG_BYTES];      // Binary message.
+    unsigned char msgbits;                        // Number of bits in message 
+    unsigned char msgtype;                        // Downlink format #
+    unsigned char crcok;                          // True if CRC was valid
+    unsigned char signalLevel;                    // Signal Amplitude
+    unsigned char ca;                             // DF 11 responder capabilities, DF 17/18 control field
+    unsigned char metype;                         // Extended squitter message type.
+    unsigned char mesub;                          // Extended squitter message subtype.
+    unsigned char fs;                             // Flight status for DF4,5,20,21
+    unsigned char feed;                           // Index of the feed the frame came from
 };
 
 struct {                           // Internal state
@@ -297,19 +648,84 @@ int  ModeAToModeC      (unsigned int ModeA);
 //
 // Functions exported from mode_s.c
 //
+uint32_t ICAOHashAddress (uint32_t a);
 void detectModeS        (uint16_t *m, uint32_t mlen);
+void modesInitChecksum  (void);
+uint32_t modesChecksum   (unsigned char *msg, int bits);
+void modesInitSyndromes (void);
+int  initRecentlySeenICAOAddrs(void);
+void modesChecksumBatch (unsigned char *msg[], const int bits[], uint32_t crc[], int n);
 void decodeModesMessage (struct modesMessage *mm, unsigned char *msg);
+void decodeBinFrame     (unsigned char *p, struct modesMessage *mm);
+void decodeModesBatch   (const uint8_t *frames[], size_t n, struct modesMessage *out);
+void decodeModesHeader  (struct modesMessage *mm, unsigned char *msg);
+void decodeModesAddress (struct modesMessage *mm);
+void decodeModesFields  (struct modesMessage *mm);
+void decodeModesVelocity(struct modesMessage *mm);
 void useModesMessage    (struct modesMessage *mm);
 int  decodeCPR          (struct aircraft *a, int fflag, int surface);
 int  decodeCPRrelative  (struct aircraft *a, int fflag, int surface);
+int  cprNLFunction      (double lat);
+//
+// Functions exported from ppup1090.c
+//
+struct client *modesCreateClient  (void);
+void           modesFreeClient    (struct client *c);
+void           modesParseBeast    (struct client *c, unsigned char *p, int len);
+void           modesReadFromClient(struct client *c);
+void           modesClockUpdate   (void);
+void           modesEventLoop     (struct client **c, int nClients);
+void           modesReplay        (char *pFile);
+//
+// Functions exported from pipeline.c
+//
+int      ringInit         (struct stRing *r, size_t nItemSize, uint32_t nSize);
+void    *ringProduce      (struct stRing *r);
+void     ringPush         (struct stRing *r);
+void     ringPublish      (struct stRing *r);
+void    *ringConsume      (struct stRing *r);
+void     ringRelease      (struct stRing *r);
+uint32_t ringConsumeBatch (struct stRing *r, void **ppItems, uint32_t nMax);
+void     ringReleaseBatch (struct stRing *r, uint32_t n);
+uint32_t ringDepth        (struct stRing *r);
+void     ringWait         (struct stRing *r, uint32_t *pCount, uint32_t nSeen, int nMs);
+void     ringWake         (struct stRing *r);
+int      pipelineInit     (void);
+int      pipelineStart    (void);
+void     pipelineStop     (void);
+void     pipelineDrain    (void);
+int      pipelinePushFrame(unsigned char *p);
+void     pipelineFlush    (void);
+void     pipelineTick     (void);
+//
+// Functions exported from metrics.c
+//
+uint64_t metricsClock     (void);
+void     metricsLatency   (struct stLatency *l, uint64_t llStart);
+int      metricsInit      (void);
+int      metricsServe     (struct stScrape *s, struct client **c, int nClients);
+void     metricsClose     (struct stScrape *s);
 //
 // Functions exported from interactive.c
 //
 struct aircraft* interactiveReceiveData(struct modesMessage *mm);
 void  interactiveRemoveStaleAircrafts(void);
-int   decodeBinMessage   (char *p);
+int   decodeBinMessage   (unsigned char *p);
 struct aircraft *interactiveFindAircraft(uint32_t addr);
+struct stShard  *interactiveShard       (uint32_t addr);
+void  interactiveRemoveStaleShard(struct stShard *s, time_t now);
+void  interactiveHousekeeping    (time_t now);
+void  interactiveLinkAircraft    (void);
+void  interactiveUpdateAircraftModeS(void);
+uint32_t interactiveAircraftCount(void);
 struct stDF     *interactiveFindDF      (uint32_t addr);
+int   poolInit      (struct stPool *p, size_t nItemSize, uint32_t nItems);
+void *poolAlloc     (struct stPool *p);
+void  poolFree      (struct stPool *p, void *pItem);
+int   icaoHashInit  (struct stICAOHash *h, uint32_t nSize);
+void *icaoHashFind  (struct stICAOHash *h, uint32_t addr);
+int   icaoHashInsert(struct stICAOHash *h, uint32_t addr, void *pData);
+void  icaoHashDelete(struct stICAOHash *h, uint32_t addr);
 
 //
 // Functions exported from coaa1090.c
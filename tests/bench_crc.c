@@ -0,0 +1,146 @@
+// ppup1090, a Mode S PlanePlotter Uploader for dump1090 devices.
+//
+// Copyright (C) 2013-2021 by Malcolm Robb <Support@ATTAvionics.com>
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  *  Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//
+//  *  Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "ppup1090.h"
+//
+// Times the Mode S checksum three ways, in ns per frame for short and long
+// frames: the bit at a time loop modesChecksum() used to be, the byte at a
+// time table it is now, and modesChecksumBatch(). All three are checked to
+// agree before anything is timed.
+//
+#define BENCH_CRC_FRAMES 65536      // Random frames, power of two required
+#define BENCH_CRC_ROUNDS 50         // Times through them for each timing
+
+extern uint32_t modes_checksum_table[112];
+
+static unsigned char msgs[BENCH_CRC_FRAMES][MODES_LONG_MSG_BYTES];
+static uint32_t      nSeed = 1;
+
+static unsigned char benchRandom(void) {
+    nSeed = nSeed * 1103515245 + 12345;
+    return (unsigned char) (nSeed >> 16);
+}
+//
+//=========================================================================
+//
+// modesChecksum() as it was, xoring in a modes_checksum_table entry for
+// each bit set
+//
+static uint32_t modesChecksumBitwise(unsigned char *msg, int bits) {
+    uint32_t   crc = 0;
+    uint32_t   rem;
+    int        offset = (bits == 112) ? 0 : (112-56);
+    uint8_t    theByte = *msg;
+    uint32_t * pCRCTable = &modes_checksum_table[offset];
+    int j;
+
+    // We don't really need to include the checksum itself
+    bits -= 24;
+    for(j = 0; j < bits; j++) {
+        if ((j & 7) == 0)
+            theByte = *msg++;
+
+        // If bit is set, xor with corresponding table entry.
+        if (theByte & 0x80) {crc ^= *pCRCTable;}
+        pCRCTable++;
+        theByte = theByte << 1;
+    }
+
+    rem = (msg[0] << 16) | (msg[1] << 8) | msg[2]; // message checksum
+    return ((crc ^ rem) & 0x00FFFFFF); // 24 bit checksum syndrome.
+}
+//
+//=========================================================================
+//
+static double benchSeconds(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec + ts.tv_nsec * 1e-9);
+}
+//
+//=========================================================================
+//
+int main(void) {
+    static unsigned char *pMsg[MODES_DECODE_BATCH];
+    static int            nBits[MODES_DECODE_BATCH];
+    static uint32_t       crc[MODES_DECODE_BATCH];
+    volatile uint32_t     nSink = 0;
+    double t0, t1, t2, t3;
+    int    bits, round, j, k;
+
+    modesInitChecksum();
+    for (j = 0; j < BENCH_CRC_FRAMES; j++) {
+        for (k = 0; k < MODES_LONG_MSG_BYTES; k++) msgs[j][k] = benchRandom();
+    }
+
+    for (bits = MODES_SHORT_MSG_BITS; bits <= MODES_LONG_MSG_BITS; bits += MODES_SHORT_MSG_BITS) {
+        for (j = 0; j < MODES_DECODE_BATCH; j++) nBits[j] = bits;
+
+        for (j = 0; j < BENCH_CRC_FRAMES; j += MODES_DECODE_BATCH) {
+            for (k = 0; k < MODES_DECODE_BATCH; k++) pMsg[k] = msgs[j + k];
+            modesChecksumBatch(pMsg, nBits, crc, MODES_DECODE_BATCH);
+            for (k = 0; k < MODES_DECODE_BATCH; k++) {
+                if ( (modesChecksumBitwise(msgs[j + k], bits) != modesChecksum(msgs[j + k], bits))
+                  || (crc[k] != modesChecksum(msgs[j + k], bits)) ) {
+                    printf("bench_crc: the checksums disagree on %d bit frame %d\n", bits, j + k);
+                    return (1);
+                }
+            }
+        }
+
+        t0 = benchSeconds();
+        for (round = 0; round < BENCH_CRC_ROUNDS; round++) {
+            for (j = 0; j < BENCH_CRC_FRAMES; j++) nSink += modesChecksumBitwise(msgs[j], bits);
+        }
+        t1 = benchSeconds();
+        for (round = 0; round < BENCH_CRC_ROUNDS; round++) {
+            for (j = 0; j < BENCH_CRC_FRAMES; j++) nSink += modesChecksum(msgs[j], bits);
+        }
+        t2 = benchSeconds();
+        for (round = 0; round < BENCH_CRC_ROUNDS; round++) {
+            for (j = 0; j < BENCH_CRC_FRAMES; j += MODES_DECODE_BATCH) {
+                for (k = 0; k < MODES_DECODE_BATCH; k++) pMsg[k] = msgs[j + k];
+                modesChecksumBatch(pMsg, nBits, crc, MODES_DECODE_BATCH);
+                nSink += crc[0];
+            }
+        }
+        t3 = benchSeconds();
+
+        printf("bench_crc: %3d bits: bitwise %6.1f ns/frame, table %5.1f ns/frame, batch %5.1f ns/frame\n", bits,
+               (t1 - t0) * 1e9 / ((double) BENCH_CRC_ROUNDS * BENCH_CRC_FRAMES),
+               (t2 - t1) * 1e9 / ((double) BENCH_CRC_ROUNDS * BENCH_CRC_FRAMES),
+               (t3 - t2) * 1e9 / ((double) BENCH_CRC_ROUNDS * BENCH_CRC_FRAMES));
+    }
+    return (0);
+}
+//
+//=========================================================================
+//
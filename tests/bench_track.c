@@ -0,0 +1,141 @@
+// ppup1090, a Mode S PlanePlotter Uploader for dump1090 devices.
+//
+// Copyright (C) 2013-2021 by Malcolm Robb <Support@ATTAvionics.com>
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  *  Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//
+//  *  Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "ppup1090.h"
+//
+// Times interactiveReceiveData(), in ns per message, for messages from a
+// fleet of N aircraft (the argument, 200000 if none) arriving in random
+// order, once every aircraft has a record. With a big fleet most records
+// aren't in cache, so this shows how many cache lines a message touches.
+// The fastest of a few runs is reported, as the slower ones are mostly
+// other things on the machine getting in the way.
+//
+#define BENCH_TRACK_CALLS    8000000
+#define BENCH_TRACK_RUNS     5
+#define BENCH_TRACK_MESSAGES 4096       // Different messages cycled through, power of two required
+
+static uint64_t llSeed = 88172645463325252ULL;
+
+static uint64_t benchRandom(void) {
+    llSeed ^= llSeed << 13;
+    llSeed ^= llSeed >> 7;
+    llSeed ^= llSeed << 17;
+    return (llSeed);
+}
+//
+//=========================================================================
+//
+// The parts of ppup1090Init() the tracker needs, with room for nAircraft
+//
+static void benchInit(int nAircraft) {
+    pthread_mutex_init(&Modes.pDF_mutex, NULL);
+    Modes.interactive_delete_ttl  = MODES_INTERACTIVE_DELETE_TTL;
+    Modes.interactive_display_ttl = MODES_INTERACTIVE_DISPLAY_TTL;
+    Modes.nDFHistory              = MODES_DF_HISTORY_LEN;
+    Modes.nShards                 = 1;
+    Modes.tNow                    = time(NULL);
+    Modes.llNowMs                 = (uint64_t) Modes.tNow * 1000;
+
+    if ( (icaoHashInit(&Modes.DFHash, MODES_AIRCRAFT_HASH_LEN))
+      || (NULL == (Modes.pShards = (struct stShard *) calloc(1, sizeof(struct stShard))))
+      || (icaoHashInit(&Modes.pShards[0].AircraftHash, MODES_AIRCRAFT_HASH_LEN))
+      || (poolInit(&Modes.pShards[0].AircraftPool, sizeof(struct aircraft), nAircraft))
+      || (NULL == (Modes.pDFRing = (struct stDF *) calloc(Modes.nDFHistory, sizeof(struct stDF)))) ) {
+        fprintf(stderr, "Out of memory allocating aircraft table.\n");
+        exit(1);
+    }
+    Modes.pShards[0].tWheel = Modes.tNow;
+}
+//
+//=========================================================================
+//
+int main(int argc, char **argv) {
+    struct modesMessage *mm;
+    struct modesMessage *m;
+    struct timespec      t0, t1;
+    uint32_t            *pAddr;
+    int                  nAircraft = (argc > 1) ? atoi(argv[1]) : 200000;
+    double               fNs, fBestNs = 0.0;
+    int                  j, run;
+
+    if (nAircraft < 1) {
+        fprintf(stderr, "Usage: bench_track [aircraft]\n");
+        exit(1);
+    }
+    benchInit(nAircraft);
+
+    mm    = (struct modesMessage *) calloc(BENCH_TRACK_MESSAGES, sizeof(struct modesMessage));
+    pAddr = (uint32_t *) malloc(nAircraft * sizeof(uint32_t));
+    if ((!mm) || (!pAddr)) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    // Alternate altitude and velocity squitters, with a few altitudes so
+    // some messages move the aircraft to another altitude bucket
+    for (j = 0; j < BENCH_TRACK_MESSAGES; j++) {
+        m           = &mm[j];
+        m->crcok    = 1;
+        m->msgtype  = 17;
+        m->bFlags   = (j & 1) ? MODES_ACFLAGS_ALTITUDE_VALID
+                              : (MODES_ACFLAGS_SPEED_VALID | MODES_ACFLAGS_HEADING_VALID | MODES_ACFLAGS_VERTRATE_VALID);
+        m->altitude = 30000 + (j & 7) * 100;
+        m->velocity = 400;
+        m->heading  = 90;
+    }
+
+    // Give every aircraft its record before timing anything
+    for (j = 0; j < nAircraft; j++) {
+        pAddr[j]   = (uint32_t) benchRandom() & 0xFFFFFF;
+        mm[0].addr = pAddr[j];
+        interactiveReceiveData(&mm[0]);
+    }
+
+    for (run = 0; run < BENCH_TRACK_RUNS; run++) {
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (j = 0; j < BENCH_TRACK_CALLS; j++) {
+            m       = &mm[j & (BENCH_TRACK_MESSAGES - 1)];
+            m->addr = pAddr[(benchRandom() >> 20) % nAircraft];
+            interactiveReceiveData(m);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+
+        fNs = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / BENCH_TRACK_CALLS;
+        if ((run == 0) || (fNs < fBestNs)) {
+            fBestNs = fNs;
+        }
+    }
+
+    printf("bench_track: %7d aircraft: %.1f ns/message\n", interactiveAircraftCount(), fBestNs);
+    return (0);
+}
+//
+//=========================================================================
+//
@@ -0,0 +1,232 @@
+// ppup1090, a Mode S PlanePlotter Uploader for dump1090 devices.
+//
+// Copyright (C) 2013-2021 by Malcolm Robb <Support@ATTAvionics.com>
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  *  Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//
+//  *  Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "ppup1090.h"
+//
+// Checks decodeModesBatch() leaves every modesMessage exactly as
+// decodeBinFrame() does, field by field. The frames are a mix of every
+// kind we see: DF17/18 squitters (some with one or two bit errors), DF11
+// all-call replies, DF0/4/5/16/20/21 replies whose parity is overlaid with
+// the address, Mode A/C, and plain garbage, in random order from a small
+// fleet so the ICAO whitelist matters. Both decodes start with an empty
+// whitelist and go through the frames in the same order, and the batch
+// decode is done in chunks of several sizes, so the frames fall at
+// different places in the batches.
+//
+#define TEST_BATCH_FRAMES 4000
+#define TEST_BATCH_FLEET  64
+
+static const char *szSquitters[] = {   // DF17 with the address and parity to be replaced
+    "8D4840D6202CC371C32CE0576098",     // Identification
+    "8D40621D58C382D690C8AC2863A7",     // Airborne position, even
+    "8D40621D58C386435CC412692AD6",     // Airborne position, odd
+    "8D485020994409940838175B284F",     // Velocity
+    "8DA05F219B06B6AF189400CBC33F",     // Velocity, airspeed
+    "8D4840D6380000A7E7B1E8D7D3F6"};    // Surface position
+
+static const size_t nChunks[] = {1, 3, 17, 255, 256, 257, 600};
+
+static unsigned char frames[TEST_BATCH_FRAMES][MODES_FRAME_BYTES];
+static struct modesMessage ref[TEST_BATCH_FRAMES];
+static struct modesMessage out[TEST_BATCH_FRAMES];
+static uint32_t nSeed = 1;
+
+static uint32_t testRandom(void) {
+    nSeed ^= nSeed << 13;               // Our own xorshift, so every libc sees the same frames
+    nSeed ^= nSeed >> 17;
+    nSeed ^= nSeed << 5;
+    return (nSeed);
+}
+//
+//=========================================================================
+//
+// Set the parity of a message so its syndrome comes out as ap: zero for
+// DF11/17/18, or the address for the replies which overlay it on the parity
+//
+static void setParity(unsigned char *msg, int bits, uint32_t ap) {
+    int n = bits / 8;
+
+    msg[n - 3] = msg[n - 2] = msg[n - 1] = 0;
+    ap ^= modesChecksum(msg, bits);
+    msg[n - 3] = (unsigned char) (ap >> 16);
+    msg[n - 2] = (unsigned char) (ap >>  8);
+    msg[n - 1] = (unsigned char)  ap;
+}
+//
+//=========================================================================
+//
+static void flipBits(unsigned char *msg, int bits, int n) {
+    int j;
+
+    while (n--) {
+        j = 5 + (testRandom() % (bits - 5));    // Not in the DF, which says the length
+        msg[j >> 3] ^= 0x80 >> (j & 7);
+    }
+}
+//
+//=========================================================================
+//
+static void makeFrame(unsigned char *p, uint32_t *pFleet) {
+    unsigned char *msg  = &p[8];
+    uint32_t       addr = pFleet[testRandom() % TEST_BATCH_FLEET];
+    unsigned int   v;
+    int            bits = MODES_LONG_MSG_BITS;
+    int            j, r;
+    static const int nShortDF[] = {0, 4, 5};
+    static const int nLongDF[]  = {16, 20, 21};
+
+    memset(p, 0, MODES_FRAME_BYTES);
+    for (j = 1; j < 8; j++) p[j] = (unsigned char) testRandom();  // Timestamp and signal level
+    p[MODES_FRAME_FEED] = (unsigned char) (testRandom() & 1);
+    for (j = 0; j < MODES_LONG_MSG_BYTES; j++) msg[j] = (unsigned char) testRandom();
+
+    switch (r = testRandom() % 8) {
+    case 0: case 1:                     // DF17/18 squitter, from a real one or random
+        if (r == 0) {
+            for (j = 0; j < MODES_LONG_MSG_BYTES; j++) {
+                sscanf(&szSquitters[testRandom() % 6][j * 2], "%2x", &v);
+                msg[j] = (unsigned char) v;
+            }
+        }
+        msg[0] = (unsigned char) (((testRandom() & 3) ? 17 : 18) << 3) | (msg[0] & 7);
+        msg[1] = (unsigned char) (addr >> 16);
+        msg[2] = (unsigned char) (addr >>  8);
+        msg[3] = (unsigned char)  addr;
+        setParity(msg, bits, 0);
+        if ((j = testRandom() % 8) < 3) flipBits(msg, bits, j);
+        break;
+
+    case 2:                             // DF11 all-call reply
+        bits   = MODES_SHORT_MSG_BITS;
+        msg[0] = (unsigned char) ((11 << 3) | (msg[0] & 7));
+        msg[1] = (unsigned char) (addr >> 16);
+        msg[2] = (unsigned char) (addr >>  8);
+        msg[3] = (unsigned char)  addr;
+        setParity(msg, bits, (testRandom() & 1) ? 0 : (testRandom() % 80));
+        if ((testRandom() % 4) == 0) flipBits(msg, bits, 1);
+        break;
+
+    case 3:                             // Short reply with address/parity
+        bits   = MODES_SHORT_MSG_BITS;
+        msg[0] = (unsigned char) ((nShortDF[testRandom() % 3] << 3) | (msg[0] & 7));
+        setParity(msg, bits, addr);
+        break;
+
+    case 4:                             // Long reply with address/parity
+        msg[0] = (unsigned char) ((nLongDF[testRandom() % 3] << 3) | (msg[0] & 7));
+        setParity(msg, bits, addr);
+        break;
+
+    case 5:                             // Mode A/C
+        p[0] = '1';
+        return;
+
+    default:                            // Garbage, of either length
+        bits = (msg[0] & 0x80) ? MODES_LONG_MSG_BITS : MODES_SHORT_MSG_BITS;
+        break;
+    }
+    p[0] = (bits == MODES_LONG_MSG_BITS) ? '3' : '2';
+}
+//
+//=========================================================================
+//
+#define TEST_FIELD(f) if (a->f != b->f) { printf("frame %d: " #f " differs\n", n); return (1); }
+#define TEST_ARRAY(f) if (memcmp(a->f, b->f, sizeof(a->f))) { printf("frame %d: " #f " differs\n", n); return (1); }
+
+static int compareMessages(int n, struct modesMessage *a, struct modesMessage *b) {
+    TEST_FIELD(timestampMsg);  TEST_FIELD(crc);           TEST_FIELD(addr);
+    TEST_FIELD(iid);           TEST_FIELD(fLat);          TEST_FIELD(fLon);
+    TEST_FIELD(heading);       TEST_FIELD(velocity);      TEST_FIELD(ew_velocity);
+    TEST_FIELD(ns_velocity);   TEST_FIELD(vert_rate);     TEST_FIELD(raw_latitude);
+    TEST_FIELD(raw_longitude); TEST_FIELD(modeA);         TEST_FIELD(altitude);
+    TEST_FIELD(unit);          TEST_FIELD(bFlags);        TEST_ARRAY(flight);
+    TEST_ARRAY(msg);           TEST_FIELD(msgbits);       TEST_FIELD(msgtype);
+    TEST_FIELD(crcok);         TEST_FIELD(signalLevel);   TEST_FIELD(ca);
+    TEST_FIELD(metype);        TEST_FIELD(mesub);         TEST_FIELD(fs);
+    TEST_FIELD(feed);
+    return (0);
+}
+//
+//=========================================================================
+//
+int main(void) {
+    const uint8_t *pFrames[TEST_BATCH_FRAMES];
+    uint32_t       pFleet[TEST_BATCH_FLEET];
+    int            nGood[33];
+    size_t         j, m, k;
+    long           nFailed = 0;
+    int            nFixBits, n;
+
+    modesInitChecksum();
+    Modes.tNow    = time(NULL);
+    Modes.llNowMs = (uint64_t) Modes.tNow * 1000;
+
+    for (j = 0; j < TEST_BATCH_FLEET; j++) {
+        pFleet[j] = testRandom() & 0xFFFFFF;
+    }
+    for (j = 0; j < TEST_BATCH_FRAMES; j++) {
+        makeFrame(frames[j], pFleet);
+        pFrames[j] = frames[j];
+    }
+
+    for (nFixBits = 0; nFixBits <= 2; nFixBits++) {
+        Modes.nFixBits = nFixBits;
+
+        initRecentlySeenICAOAddrs();
+        for (j = 0; j < TEST_BATCH_FRAMES; j++) {
+            decodeBinFrame(frames[j], &ref[j]);
+        }
+
+        initRecentlySeenICAOAddrs();
+        for (j = k = 0; j < TEST_BATCH_FRAMES; j += m, k++) {
+            m = nChunks[k % (sizeof(nChunks) / sizeof(nChunks[0]))];
+            if (m > (TEST_BATCH_FRAMES - j)) m = TEST_BATCH_FRAMES - j;
+            decodeModesBatch(&pFrames[j], m, &out[j]);
+        }
+
+        memset(nGood, 0, sizeof(nGood));
+        for (j = 0; j < TEST_BATCH_FRAMES; j++) {
+            if (compareMessages((int) j, &ref[j], &out[j])) {
+                if (++nFailed >= 10) break;
+            }
+            if ((ref[j].crcok) && (ref[j].msgtype < 33)) nGood[ref[j].msgtype]++;
+        }
+
+        printf("test_batch: --fix-bits %d, good DF0 %d DF4 %d DF5 %d DF11 %d DF16 %d DF17 %d DF18 %d DF20 %d DF21 %d Mode A/C %d\n",
+               nFixBits, nGood[0], nGood[4], nGood[5], nGood[11], nGood[16], nGood[17], nGood[18], nGood[20], nGood[21], nGood[32]);
+    }
+
+    n = TEST_BATCH_FRAMES * 3;
+    printf("test_batch: %d frames, %ld failed\n", n, nFailed);
+    return (nFailed ? 1 : 0);
+}
+//
+//=========================================================================
+//
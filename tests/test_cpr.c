@@ -0,0 +1,216 @@
+// ppup1090, a Mode S PlanePlotter Uploader for dump1090 devices.
+//
+// Copyright (C) 2013-2021 by Malcolm Robb <Support@ATTAvionics.com>
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  *  Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//
+//  *  Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "ppup1090.h"
+//
+// A differential test of the two CPR decoders. The same source is built
+// twice, once against a mode_s.c built with MODES_CPR_FIXED and once against
+// the floating point one, and "make test" runs
+//
+//     ./tests/test_cpr_fixed | ./tests/test_cpr
+//
+// Both make the same even/odd pairs from the same seed, encoded from random
+// positions (and some just random bits), and decode each one every way the
+// tracker can: globally and relative to the last position or the receiver,
+// airborne and surface, using either half last. The fixed point build prints
+// its results, and the floating point build reads them back and checks the
+// return codes and flags are the same, and the positions within
+// TEST_CPR_TOLERANCE degrees.
+//
+#define TEST_CPR_PAIRS     100000
+#define TEST_CPR_TOLERANCE 1e-6
+#define TEST_CPR_SEEN      1000000      // Any time will do, but it must be the same in both
+
+static uint64_t llSeed = 1;
+
+static double testRandom(void) {
+    // Our own generator, so both builds see the same numbers whatever the libc
+    llSeed = llSeed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return ((double) (llSeed >> 11) / 9007199254740992.0); // [0, 1)
+}
+//
+//=========================================================================
+//
+static double testMod(double a, double b) {
+    double r = fmod(a, b);
+    return ((r < 0) ? r + b : r);
+}
+//
+//=========================================================================
+//
+// Encode lat/lon the way a transponder does, for the given half and type
+//
+static void cprEncode(double lat, double lon, int fflag, int surface, int *pLat, int *pLon) {
+    double span = surface ? 90.0 : 360.0;
+    double dlat = span / (60 - fflag);
+    double rlat, dlon;
+    int    yz, xz, nl;
+
+    yz   = (int) floor(131072.0 * testMod(lat, dlat) / dlat + 0.5);
+    rlat = dlat * (yz / 131072.0 + floor(lat / dlat));
+    nl   = cprNLFunction(rlat) - fflag;
+    dlon = span / ((nl < 1) ? 1 : nl);
+    xz   = (int) floor(131072.0 * testMod(lon, dlon) / dlon + 0.5);
+
+    *pLat = yz & 0x1FFFF;
+    *pLon = xz & 0x1FFFF;
+}
+//
+//=========================================================================
+//
+static long nChecked, nFailed;
+#ifndef MODES_CPR_FIXED
+static long nDecoded;
+static double fMaxError;
+#endif
+
+static void checkCPR(struct aircraft *t, int relative, int fflag, int surface) {
+    struct aircraft a = *t;
+    int rc;
+
+    rc = relative ? decodeCPRrelative(&a, fflag, surface) : decodeCPR(&a, fflag, surface);
+    nChecked++;
+
+#ifdef MODES_CPR_FIXED
+    printf("%d %d %.9f %.9f\n", rc, a.bFlags, a.lat, a.lon);
+#else
+    {
+    int    rcFixed, bFlagsFixed;
+    double latFixed, lonFixed, fError;
+
+    if (scanf("%d %d %lf %lf", &rcFixed, &bFlagsFixed, &latFixed, &lonFixed) != 4) {
+        printf("test_cpr: the fixed point results ran out after %ld decodes\n", nChecked - 1);
+        exit(1);
+    }
+
+    if ((rc != rcFixed) || (a.bFlags != bFlagsFixed)) {
+        if (nFailed++ < 10)
+            printf("relative=%d fflag=%d surface=%d: returned %d flags %04X, fixed point %d flags %04X\n",
+                   relative, fflag, surface, rc, a.bFlags, rcFixed, bFlagsFixed);
+    } else if (rc == 0) {
+        nDecoded++;
+        fError = fabs(a.lat - latFixed);
+        if (fabs(a.lon - lonFixed) > fError) fError = fabs(a.lon - lonFixed);
+        if (fError > fMaxError) fMaxError = fError;
+        if (fError > TEST_CPR_TOLERANCE) {
+            if (nFailed++ < 10)
+                printf("relative=%d fflag=%d surface=%d: %.9f %.9f, fixed point %.9f %.9f\n",
+                       relative, fflag, surface, a.lat, a.lon, latFixed, lonFixed);
+        }
+    }
+    }
+#endif
+}
+//
+//=========================================================================
+//
+static void checkAllWays(struct aircraft *t, int relative, int surface) {
+    checkCPR(t, relative, 0, surface);
+    checkCPR(t, relative, 1, surface);
+}
+//
+//=========================================================================
+//
+int main(void) {
+    struct aircraft t;
+    double lat, lon;
+    long   j;
+    int    surface;
+
+    Modes.interactive_display_ttl = MODES_INTERACTIVE_DISPLAY_TTL;
+
+    for (j = 0; j < TEST_CPR_PAIRS; j++) {
+        // Mostly within the +/-87 degrees NL has zones for, some right up to the poles
+        lat = (j % 7) ? testRandom() * 174.0 - 87.0 : testRandom() * 180.0 - 90.0;
+        lon = testRandom() * 360.0 - 180.0;
+
+        for (surface = 0; surface < 2; surface++) {
+            memset(&t, 0, sizeof(t));
+            t.seen = TEST_CPR_SEEN;
+
+            if ((j % 10) == 0) {
+                // Random bits, which often don't make a position at all
+                t.even_cprlat = (int) (testRandom() * 131072.0);
+                t.even_cprlon = (int) (testRandom() * 131072.0);
+                t.odd_cprlat  = (int) (testRandom() * 131072.0);
+                t.odd_cprlon  = (int) (testRandom() * 131072.0);
+            } else {
+                // The odd half a little way on from the even one
+                cprEncode(lat, lon, 0, surface, &t.even_cprlat, &t.even_cprlon);
+                cprEncode(lat + (testRandom() - 0.5) * 0.02, lon + (testRandom() - 0.5) * 0.02,
+                          1, surface, &t.odd_cprlat, &t.odd_cprlon);
+            }
+
+            // Global, with the receiver as the surface reference
+            Modes.bUserFlags = MODES_USER_LATLON_VALID;
+            Modes.fUserLat   = lat + (testRandom() - 0.5) * 4.0;
+            Modes.fUserLon   = lon + (testRandom() - 0.5) * 4.0;
+            checkAllWays(&t, 0, surface);
+
+            // Global, with the last position as the surface reference
+            t.bFlags     = MODES_ACFLAGS_LATLON_VALID;
+            t.lat        = lat + (testRandom() - 0.5);
+            t.lon        = lon + (testRandom() - 0.5);
+            t.seenLatLon = t.seen;
+            checkAllWays(&t, 0, surface);
+
+            // Relative to the last position
+            t.bFlags = MODES_ACFLAGS_LATLON_REL_OK;
+            t.lat    = lat + (testRandom() - 0.5) * (surface ? 0.6 : 2.5);
+            t.lon    = lon + (testRandom() - 0.5) * (surface ? 0.6 : 2.5);
+            checkAllWays(&t, 1, surface);
+
+            // Relative to the receiver
+            t.bFlags = 0;
+            checkAllWays(&t, 1, surface);
+
+            // With no reference at all
+            Modes.bUserFlags = 0;
+            checkAllWays(&t, 0, surface);
+            checkAllWays(&t, 1, surface);
+        }
+    }
+
+#ifndef MODES_CPR_FIXED
+    {
+    int rcFixed;
+    if (scanf("%d", &rcFixed) == 1) {
+        printf("test_cpr: the fixed point build decoded more than we did\n");
+        nFailed++;
+    }
+    }
+    printf("test_cpr: %ld decodes, %ld positions, largest difference %.3g degrees, %ld failed\n",
+           nChecked, nDecoded, fMaxError, nFailed);
+#endif
+    return (nFailed ? 1 : 0);
+}
+//
+//=========================================================================
+//
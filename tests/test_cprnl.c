@@ -0,0 +1,159 @@
+// ppup1090, a Mode S PlanePlotter Uploader for dump1090 devices.
+//
+// Copyright (C) 2013-2021 by Malcolm Robb <Support@ATTAvionics.com>
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  *  Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//
+//  *  Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "ppup1090.h"
+//
+// Checks cprNLFunction() gives the same zone count as the chain of compares
+// it replaced, for every latitude from -90 to 90 in steps of 0.0001 degrees,
+// and for each zone boundary exactly and the doubles either side of it.
+//
+static int cprNLReference(double lat) {
+    if (lat < 0) lat = -lat; // Table is simmetric about the equator
+    if (lat < 10.47047130) return 59;
+    if (lat < 14.82817437) return 58;
+    if (lat < 18.18626357) return 57;
+    if (lat < 21.02939493) return 56;
+    if (lat < 23.54504487) return 55;
+    if (lat < 25.82924707) return 54;
+    if (lat < 27.93898710) return 53;
+    if (lat < 29.91135686) return 52;
+    if (lat < 31.77209708) return 51;
+    if (lat < 33.53993436) return 50;
+    if (lat < 35.22899598) return 49;
+    if (lat < 36.85025108) return 48;
+    if (lat < 38.41241892) return 47;
+    if (lat < 39.92256684) return 46;
+    if (lat < 41.38651832) return 45;
+    if (lat < 42.80914012) return 44;
+    if (lat < 44.19454951) return 43;
+    if (lat < 45.54626723) return 42;
+    if (lat < 46.86733252) return 41;
+    if (lat < 48.16039128) return 40;
+    if (lat < 49.42776439) return 39;
+    if (lat < 50.67150166) return 38;
+    if (lat < 51.89342469) return 37;
+    if (lat < 53.09516153) return 36;
+    if (lat < 54.27817472) return 35;
+    if (lat < 55.44378444) return 34;
+    if (lat < 56.59318756) return 33;
+    if (lat < 57.72747354) return 32;
+    if (lat < 58.84763776) return 31;
+    if (lat < 59.95459277) return 30;
+    if (lat < 61.04917774) return 29;
+    if (lat < 62.13216659) return 28;
+    if (lat < 63.20427479) return 27;
+    if (lat < 64.26616523) return 26;
+    if (lat < 65.31845310) return 25;
+    if (lat < 66.36171008) return 24;
+    if (lat < 67.39646774) return 23;
+    if (lat < 68.42322022) return 22;
+    if (lat < 69.44242631) return 21;
+    if (lat < 70.45451075) return 20;
+    if (lat < 71.45986473) return 19;
+    if (lat < 72.45884545) return 18;
+    if (lat < 73.45177442) return 17;
+    if (lat < 74.43893416) return 16;
+    if (lat < 75.42056257) return 15;
+    if (lat < 76.39684391) return 14;
+    if (lat < 77.36789461) return 13;
+    if (lat < 78.33374083) return 12;
+    if (lat < 79.29428225) return 11;
+    if (lat < 80.24923213) return 10;
+    if (lat < 81.19801349) return 9;
+    if (lat < 82.13956981) return 8;
+    if (lat < 83.07199445) return 7;
+    if (lat < 83.99173563) return 6;
+    if (lat < 84.89166191) return 5;
+    if (lat < 85.75541621) return 4;
+    if (lat < 86.53536998) return 3;
+    if (lat < 87.00000000) return 2;
+    else return 1;
+}
+//
+//=========================================================================
+//
+static const double cprNLBoundary[] = {
+    10.47047130, 14.82817437, 18.18626357, 21.02939493, 23.54504487,
+    25.82924707, 27.93898710, 29.91135686, 31.77209708, 33.53993436,
+    35.22899598, 36.85025108, 38.41241892, 39.92256684, 41.38651832,
+    42.80914012, 44.19454951, 45.54626723, 46.86733252, 48.16039128,
+    49.42776439, 50.67150166, 51.89342469, 53.09516153, 54.27817472,
+    55.44378444, 56.59318756, 57.72747354, 58.84763776, 59.95459277,
+    61.04917774, 62.13216659, 63.20427479, 64.26616523, 65.31845310,
+    66.36171008, 67.39646774, 68.42322022, 69.44242631, 70.45451075,
+    71.45986473, 72.45884545, 73.45177442, 74.43893416, 75.42056257,
+    76.39684391, 77.36789461, 78.33374083, 79.29428225, 80.24923213,
+    81.19801349, 82.13956981, 83.07199445, 83.99173563, 84.89166191,
+    85.75541621, 86.53536998, 87.00000000};
+
+static long nChecked, nFailed;
+
+static void checkNL(double lat) {
+    int nl  = cprNLFunction(lat);
+    int ref = cprNLReference(lat);
+
+    nChecked++;
+    if (nl != ref) {
+        if (nFailed++ < 10)
+            printf("cprNLFunction(%.10f) = %d, expected %d\n", lat, nl, ref);
+    }
+}
+//
+//=========================================================================
+//
+int main(void) {
+    long   j;
+    int    k;
+    double b;
+
+    // Every 0.0001 degrees, worked out from an integer so the steps don't drift
+    for (j = -900000; j <= 900000; j++) {
+        checkNL((double) j / 10000.0);
+    }
+
+    // Each boundary exactly, and the nearest doubles either side, both hemispheres
+    for (k = 0; k < (int) (sizeof(cprNLBoundary) / sizeof(cprNLBoundary[0])); k++) {
+        b = cprNLBoundary[k];
+        checkNL( b);  checkNL( nextafter(b, 0.0));  checkNL( nextafter(b, 90.0));
+        checkNL(-b);  checkNL(-nextafter(b, 0.0));  checkNL(-nextafter(b, 90.0));
+    }
+
+    // And the odd values either end
+    checkNL(0.0);   checkNL(-0.0);
+    checkNL(90.0);  checkNL(-90.0);
+    checkNL(HUGE_VAL); checkNL(-HUGE_VAL);
+    checkNL(NAN);
+
+    printf("test_cprnl: %ld latitudes, %ld failed\n", nChecked, nFailed);
+    return (nFailed ? 1 : 0);
+}
+//
+//=========================================================================
+//
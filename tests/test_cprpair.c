@@ -0,0 +1,159 @@
+// ppup1090, a Mode S PlanePlotter Uploader for dump1090 devices.
+//
+// Copyright (C) 2013-2021 by Malcolm Robb <Support@ATTAvionics.com>
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  *  Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//
+//  *  Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "ppup1090.h"
+//
+// Checks odd and even CPR positions are paired for a global decode on the
+// receivers 12 MHz timestamps rather than on when we processed them, by
+// feeding the two halves to interactiveReceiveData() with our own clock set
+// to whatever the case needs. There's no receiver location, so a position
+// can only come from a global decode, and each case gets an aircraft of
+// its own.
+//
+#define TEST_MS(ms) ((uint64_t) (ms) * MODES_TIMESTAMP_PER_MS)
+#define TEST_WRAP   (MODES_TIMESTAMP_MASK + 1)
+
+struct stCPRPairCase {
+    const char *szName;
+    int         nOddFeed,    nEvenFeed;
+    uint64_t    llOddStamp,  llEvenStamp;
+    uint64_t    llHostMs;                   // How long after the first half we process the second
+    int         bEvenFirst;
+    int         bPaired;                    // What we expect
+};
+
+static const struct stCPRPairCase Cases[] = {
+    {"5s apart, processed together",         0, 0, TEST_MS(100000),             TEST_MS(105000), 0,     0, 1},
+    {"5s apart, processed 15s apart",        0, 0, TEST_MS(100000),             TEST_MS(105000), 15000, 0, 1},
+    {"5s apart, even first",                 0, 0, TEST_MS(105000),             TEST_MS(100000), 3000,  1, 1},
+    {"11s apart, processed together",        0, 0, TEST_MS(100000),             TEST_MS(111000), 0,     0, 0},
+    {"11s apart, processed 5s apart",        0, 0, TEST_MS(100000),             TEST_MS(111000), 5000,  0, 0},
+    {"5s apart across the wrap",             0, 0, TEST_WRAP - TEST_MS(2000),   TEST_MS(3000),   5000,  0, 1},
+    {"5s apart across the wrap, even first", 0, 0, TEST_MS(3000),               TEST_WRAP - TEST_MS(2000), 5000, 1, 1},
+    {"11s apart across the wrap",            0, 0, TEST_WRAP - TEST_MS(5000),   TEST_MS(6000),   0,     0, 0},
+    {"mixed feeds, 5s apart on our clock",   0, 1, TEST_MS(100000),             TEST_MS(130000), 5000,  0, 1},
+    {"mixed feeds, 11s apart on our clock",  0, 1, TEST_MS(100000),             TEST_MS(101000), 11000, 0, 0},
+    {"no timestamp, 5s apart on our clock",  0, 0, 0,                           0,               5000,  0, 1},
+    {"no timestamp, 11s apart on our clock", 0, 0, 0,                           TEST_MS(101000), 11000, 0, 0},
+    {"receiver clock jumped",                2, 2, TEST_MS(100000),             TEST_MS(101000), 25000, 0, 0}};
+
+#define TEST_CPRPAIR_CASES ((int) (sizeof(Cases) / sizeof(Cases[0])))
+//
+//=========================================================================
+//
+// The parts of ppup1090Init() the tracker needs
+//
+static void testInit(void) {
+    pthread_mutex_init(&Modes.pDF_mutex, NULL);
+    Modes.interactive_delete_ttl  = MODES_INTERACTIVE_DELETE_TTL;
+    Modes.interactive_display_ttl = MODES_INTERACTIVE_DISPLAY_TTL;
+    Modes.nDFHistory              = MODES_DF_HISTORY_LEN;
+    Modes.nShards                 = 1;
+    Modes.tNow                    = time(NULL);
+    Modes.llNowMs                 = (uint64_t) Modes.tNow * 1000;
+
+    if ( (icaoHashInit(&Modes.DFHash, MODES_AIRCRAFT_HASH_LEN))
+      || (NULL == (Modes.pShards = (struct stShard *) calloc(1, sizeof(struct stShard))))
+      || (icaoHashInit(&Modes.pShards[0].AircraftHash, MODES_AIRCRAFT_HASH_LEN))
+      || (poolInit(&Modes.pShards[0].AircraftPool, sizeof(struct aircraft), TEST_CPRPAIR_CASES))
+      || (NULL == (Modes.pDFRing = (struct stDF *) calloc(Modes.nDFHistory, sizeof(struct stDF)))) ) {
+        fprintf(stderr, "Out of memory allocating aircraft table.\n");
+        exit(1);
+    }
+    Modes.pShards[0].tWheel = Modes.tNow;
+}
+//
+//=========================================================================
+//
+// Sends one half of the pair from DF17 40621D, "8D40621D58C382D690C8AC2863A7"
+// (even) or "8D40621D58C386435CC412692AD6" (odd), which decode to around
+// 52.26N 3.92E
+//
+static struct modesMessage testHalf(uint32_t addr, int bOdd, int nFeed, uint64_t llStamp) {
+    struct modesMessage mm;
+
+    memset(&mm, 0, sizeof(mm));
+    mm.crcok         = 1;
+    mm.msgtype       = 17;
+    mm.addr          = addr;
+    mm.feed          = (unsigned char) nFeed;
+    mm.timestampMsg  = llStamp;
+    mm.bFlags        = bOdd ? MODES_ACFLAGS_LLODD_VALID : MODES_ACFLAGS_LLEVEN_VALID;
+    mm.raw_latitude  = bOdd ? 74158 : 93000;
+    mm.raw_longitude = bOdd ? 50194 : 51372;
+    interactiveReceiveData(&mm);
+    return (mm);
+}
+//
+//=========================================================================
+//
+int main(void) {
+    const struct stCPRPairCase *c;
+    struct modesMessage         mm;
+    int                         j, bPaired;
+    int                         nFailed = 0;
+
+    testInit();
+
+    for (j = 0; j < TEST_CPRPAIR_CASES; j++) {
+        c = &Cases[j];
+
+        if (c->bEvenFirst) {
+            testHalf(0x100000 + j, 0, c->nEvenFeed, c->llEvenStamp);
+        } else {
+            testHalf(0x100000 + j, 1, c->nOddFeed,  c->llOddStamp);
+        }
+
+        Modes.llNowMs += c->llHostMs;
+        Modes.tNow     = (time_t) (Modes.llNowMs / 1000);
+
+        if (c->bEvenFirst) {
+            mm = testHalf(0x100000 + j, 1, c->nOddFeed,  c->llOddStamp);
+        } else {
+            mm = testHalf(0x100000 + j, 0, c->nEvenFeed, c->llEvenStamp);
+        }
+
+        bPaired = (mm.bFlags & MODES_ACFLAGS_LATLON_VALID) ? 1 : 0;
+        if ((bPaired != c->bPaired) || ((bPaired) && ((fabs(mm.fLat - 52.26) > 0.05) || (fabs(mm.fLon - 3.92) > 0.05)))) {
+            printf("test_cprpair: %s: %s, expected %s\n", c->szName,
+                   bPaired ? "paired" : "not paired", c->bPaired ? "paired" : "not paired");
+            nFailed++;
+        }
+
+        Modes.llNowMs += 60000;         // Well clear of the last case
+        Modes.tNow     = (time_t) (Modes.llNowMs / 1000);
+    }
+
+    printf("test_cprpair: %d cases, %d failed\n", TEST_CPRPAIR_CASES, nFailed);
+    return (nFailed ? 1 : 0);
+}
+//
+//=========================================================================
+//
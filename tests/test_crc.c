@@ -0,0 +1,131 @@
+// ppup1090, a Mode S PlanePlotter Uploader for dump1090 devices.
+//
+// Copyright (C) 2013-2021 by Malcolm Robb <Support@ATTAvionics.com>
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  *  Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//
+//  *  Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "ppup1090.h"
+//
+// Checks modesChecksumBatch() gives bit for bit the same syndromes as
+// modesChecksum(), for real and random messages of both lengths mixed
+// together, in batches of every size from 1 to a little over
+// MODES_DECODE_BATCH, so most sizes don't divide evenly into anything.
+//
+#define TEST_CRC_MESSAGES (MODES_DECODE_BATCH + 7)
+#define TEST_CRC_ROUNDS   64
+
+static const char *szRealFrames[] = {
+    "8D4840D6202CC371C32CE0576098",     // DF17 identification
+    "8D40621D58C382D690C8AC2863A7",     // DF17 airborne position, even
+    "8D40621D58C386435CC412692AD6",     // DF17 airborne position, odd
+    "8D485020994409940838175B284F",     // DF17 velocity
+    "8DA05F219B06B6AF189400CBC33F",     // DF17 velocity, airspeed
+    "A8001EBCFFFB23286004A73F6A5B",     // DF21
+    "5D484FDEA248F5",                   // DF11
+    "02E197B00179C3",                   // DF0
+    "20001838CA3804",                   // DF4
+    "28001A1B1A3D4C"};                  // DF5
+
+static uint32_t nSeed = 1;
+
+static unsigned char testRandom(void) {
+    nSeed = nSeed * 1103515245 + 12345; // Our own, so every libc sees the same messages
+    return (unsigned char) (nSeed >> 16);
+}
+//
+//=========================================================================
+//
+static int hexToBytes(const char *sz, unsigned char *msg) {
+    unsigned int v;
+    int j;
+
+    for (j = 0; sz[j * 2]; j++) {
+        if (sscanf(&sz[j * 2], "%2x", &v) != 1) return -1;
+        msg[j] = (unsigned char) v;
+    }
+    return (j * 8);
+}
+//
+//=========================================================================
+//
+int main(void) {
+    static unsigned char msgs[TEST_CRC_MESSAGES][MODES_LONG_MSG_BYTES];
+    unsigned char *pMsg[TEST_CRC_MESSAGES];
+    int            nBits[TEST_CRC_MESSAGES];
+    uint32_t       crc[TEST_CRC_MESSAGES];
+    int            nReal = (int) (sizeof(szRealFrames) / sizeof(szRealFrames[0]));
+    long           nChecked = 0, nFailed = 0;
+    int            round, n, j, k;
+
+    modesInitChecksum();
+
+    // The DF17s are good messages, so their syndromes should come out zero
+    for (j = 0; j < 5; j++) {
+        n = hexToBytes(szRealFrames[j], msgs[0]);
+        if (modesChecksum(msgs[0], n) != 0) {
+            printf("%s has syndrome %06X\n", szRealFrames[j], modesChecksum(msgs[0], n));
+            nFailed++;
+        }
+    }
+
+    for (round = 0; round < TEST_CRC_ROUNDS; round++) {
+        for (j = 0; j < TEST_CRC_MESSAGES; j++) {
+            pMsg[j] = msgs[j];
+            if ((round & 1) && (j < nReal)) {
+                // The real messages, some of them with a bit or two flipped
+                nBits[j] = hexToBytes(szRealFrames[j], msgs[j]);
+                if (round & 2) msgs[j][testRandom() % (nBits[j] / 8)] ^= 1 << (testRandom() & 7);
+            } else {
+                nBits[j] = (testRandom() & 1) ? MODES_LONG_MSG_BITS : MODES_SHORT_MSG_BITS;
+                for (k = 0; k < MODES_LONG_MSG_BYTES; k++) msgs[j][k] = testRandom();
+            }
+        }
+
+        for (n = 1; n <= TEST_CRC_MESSAGES; n++) {
+            // Start part way through, so each message is checked at different batch positions
+            int nFirst = (round * 13) % (TEST_CRC_MESSAGES - n + 1);
+
+            memset(crc, 0xA5, sizeof(crc));
+            modesChecksumBatch(&pMsg[nFirst], &nBits[nFirst], crc, n);
+            for (j = 0; j < n; j++) {
+                uint32_t ref = modesChecksum(pMsg[nFirst + j], nBits[nFirst + j]);
+                nChecked++;
+                if (crc[j] != ref) {
+                    if (nFailed++ < 10)
+                        printf("batch of %d, message %d (%d bits): %08X, expected %08X\n",
+                               n, j, nBits[nFirst + j], crc[j], ref);
+                }
+            }
+        }
+    }
+
+    printf("test_crc: %ld syndromes, %ld failed\n", nChecked, nFailed);
+    return (nFailed ? 1 : 0);
+}
+//
+//=========================================================================
+//
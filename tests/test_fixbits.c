@@ -0,0 +1,221 @@
+// ppup1090, a Mode S PlanePlotter Uploader for dump1090 devices.
+//
+// Copyright (C) 2013-2021 by Malcolm Robb <Support@ATTAvionics.com>
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//  *  Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//
+//  *  Redistributions in binary form must reproduce the above copyright
+//     notice, this list of conditions and the following disclaimer in the
+//     documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "ppup1090.h"
+//
+// Checks the bit error correction in decodeModesMessage(). For each
+// --fix-bits setting, every one and two bit error in some DF17/18
+// squitters must be restored, or left alone, as the setting says, and no
+// three bit error may ever be "fixed" into a message with a good CRC.
+// DF11 replies only get one bit fixed, and only for an address we've
+// already seen. The DF isn't touched, as that says how long the message is.
+//
+static const char *szSquitters[] = {
+    "8D4840D6202CC371C32CE0576098",     // DF17 identification
+    "8D40621D58C382D690C8AC2863A7",     // DF17 airborne position, even
+    "8D485020994409940838175B284F"};    // DF17 velocity, sent again below as a DF18
+
+#define TEST_FIXBITS_SQUITTERS ((int) (sizeof(szSquitters) / sizeof(szSquitters[0])) + 1)
+#define TEST_FIXBITS_FIRST     5        // First bit after the DF
+#define TEST_FIXBITS_IID       7        // Low bits of a DF11's parity the IID can be in
+
+static unsigned char Squitters[TEST_FIXBITS_SQUITTERS][MODES_LONG_MSG_BYTES];
+static unsigned char AllCall[MODES_SHORT_MSG_BYTES];
+//
+//=========================================================================
+//
+static void setParity(unsigned char *msg, int bits) {
+    int      n = bits / 8;
+    uint32_t crc;
+
+    msg[n - 3] = msg[n - 2] = msg[n - 1] = 0;
+    crc = modesChecksum(msg, bits);
+    msg[n - 3] = (unsigned char) (crc >> 16);
+    msg[n - 2] = (unsigned char) (crc >>  8);
+    msg[n - 1] = (unsigned char)  crc;
+}
+//
+//=========================================================================
+//
+// Decode msg with the bits in nBit[0..n-1] flipped
+//
+static void testDecode(const unsigned char *msg, int bits, const int *nBit, int n, struct modesMessage *mm) {
+    unsigned char buf[MODES_LONG_MSG_BYTES];
+    int           j;
+
+    memcpy(buf, msg, bits / 8);
+    for (j = 0; j < n; j++) {
+        buf[nBit[j] >> 3] ^= 0x80 >> (nBit[j] & 7);
+    }
+    decodeModesMessage(mm, buf);
+}
+//
+//=========================================================================
+//
+// Returns 1 if msg with these bits flipped came out as expected: restored
+// if bFixed, otherwise rejected
+//
+static int testSquitter(const unsigned char *msg, const int *nBit, int n, int bFixed) {
+    struct modesMessage mm;
+
+    testDecode(msg, MODES_LONG_MSG_BITS, nBit, n, &mm);
+    if (bFixed) {
+        return ((mm.crcok) && (0 == memcmp(mm.msg, msg, MODES_LONG_MSG_BYTES)));
+    }
+    return (!mm.crcok);
+}
+//
+//=========================================================================
+//
+// One bit errors in the DF11, before and after its address is seen. An
+// error in the low bits of the parity looks just like an IID, so those
+// are accepted as they are once the address is known, whatever we fix.
+//
+static int testAllCall(int nFixBits, int *pFixed, int *pTried) {
+    struct modesMessage mm;
+    int                 nBit, bIID;
+    int                 nFailed = 0;
+
+    for (nBit = TEST_FIXBITS_FIRST; nBit < MODES_SHORT_MSG_BITS; nBit++) {
+        testDecode(AllCall, MODES_SHORT_MSG_BITS, &nBit, 1, &mm);
+        if (mm.crcok) {
+            printf("test_fixbits: --fix-bits %d, DF11 bit %d accepted from an unknown address\n", nFixBits, nBit);
+            nFailed++;
+        }
+    }
+
+    testDecode(AllCall, MODES_SHORT_MSG_BITS, &nBit, 0, &mm);  // Now it's seen
+    if (!mm.crcok) {
+        printf("test_fixbits: --fix-bits %d, good DF11 rejected\n", nFixBits);
+        return (nFailed + 1);
+    }
+
+    for (nBit = TEST_FIXBITS_FIRST; nBit < MODES_SHORT_MSG_BITS; nBit++) {
+        bIID = (nBit >= (MODES_SHORT_MSG_BITS - TEST_FIXBITS_IID));
+        testDecode(AllCall, MODES_SHORT_MSG_BITS, &nBit, 1, &mm);
+        if (bIID) {
+            if ((!mm.crcok) || (mm.iid != (1U << (MODES_SHORT_MSG_BITS - 1 - nBit)))) {
+                printf("test_fixbits: --fix-bits %d, DF11 bit %d not taken as an IID\n", nFixBits, nBit);
+                nFailed++;
+            }
+        } else if (nFixBits) {
+            (*pTried)++;
+            if ((mm.crcok) && (mm.iid == 0) && (0 == memcmp(mm.msg, AllCall, MODES_SHORT_MSG_BYTES))) {
+                (*pFixed)++;
+            } else {
+                printf("test_fixbits: --fix-bits %d, DF11 bit %d not fixed\n", nFixBits, nBit);
+                nFailed++;
+            }
+        } else if (mm.crcok) {
+            printf("test_fixbits: --fix-bits 0, DF11 bit %d fixed\n", nBit);
+            nFailed++;
+        }
+    }
+    return (nFailed);
+}
+//
+//=========================================================================
+//
+int main(void) {
+    int      nBit[3];
+    int      nFixBits, s, n;
+    int      nTried[2], nFixed[2], nTriples, nMiscorrected, nAllCallTried, nAllCallFixed;
+    uint64_t nCounted[2];
+    long     nFailed = 0;
+    unsigned v;
+
+    modesInitChecksum();
+    Modes.tNow    = time(NULL);
+    Modes.llNowMs = (uint64_t) Modes.tNow * 1000;
+
+    for (s = 0; s < TEST_FIXBITS_SQUITTERS; s++) {
+        for (n = 0; n < MODES_LONG_MSG_BYTES; n++) {
+            sscanf(&szSquitters[(s < (TEST_FIXBITS_SQUITTERS - 1)) ? s : (s - 1)][n * 2], "%2x", &v);
+            Squitters[s][n] = (unsigned char) v;
+        }
+    }
+    s = TEST_FIXBITS_SQUITTERS - 1;
+    Squitters[s][0] = (unsigned char) ((18 << 3) | (Squitters[s][0] & 7));
+    setParity(Squitters[s], MODES_LONG_MSG_BITS);
+
+    AllCall[0] = (11 << 3) | 5;
+    AllCall[1] = 0x48;
+    AllCall[2] = 0x4F;
+    AllCall[3] = 0xDE;
+    setParity(AllCall, MODES_SHORT_MSG_BITS);
+
+    for (nFixBits = 0; nFixBits <= 2; nFixBits++) {
+        Modes.nFixBits  = nFixBits;
+        Modes.nFixed[0] = Modes.nFixed[1] = 0;
+        initRecentlySeenICAOAddrs();
+        memset(nTried, 0, sizeof(nTried));
+        memset(nFixed, 0, sizeof(nFixed));
+        nTriples = nMiscorrected = nAllCallTried = nAllCallFixed = 0;
+
+        for (s = 0; s < TEST_FIXBITS_SQUITTERS; s++) {
+            for (nBit[0] = TEST_FIXBITS_FIRST; nBit[0] < MODES_LONG_MSG_BITS; nBit[0]++) {
+                nTried[0]++;
+                nFixed[0] += testSquitter(Squitters[s], nBit, 1, (nFixBits >= 1));
+
+                for (nBit[1] = nBit[0] + 1; nBit[1] < MODES_LONG_MSG_BITS; nBit[1]++) {
+                    nTried[1]++;
+                    nFixed[1] += testSquitter(Squitters[s], nBit, 2, (nFixBits >= 2));
+
+                    for (nBit[2] = nBit[1] + 1; nBit[2] < MODES_LONG_MSG_BITS; nBit[2]++) {
+                        nTriples++;
+                        nMiscorrected += !testSquitter(Squitters[s], nBit, 3, 0);
+                    }
+                }
+            }
+        }
+        nCounted[0] = Modes.nFixed[0];
+        nCounted[1] = Modes.nFixed[1];
+
+        nFailed += (nTried[0] - nFixed[0]) + (nTried[1] - nFixed[1]) + nMiscorrected;
+        nFailed += testAllCall(nFixBits, &nAllCallFixed, &nAllCallTried);
+
+        // The counts have to agree with what was fixed
+        if ( (nCounted[0] != (uint64_t) ((nFixBits >= 1) ? nTried[0] : 0))
+          || (nCounted[1] != (uint64_t) ((nFixBits >= 2) ? nTried[1] : 0)) ) {
+            printf("test_fixbits: --fix-bits %d, counted %llu and %llu fixes\n", nFixBits,
+                   (unsigned long long) nCounted[0], (unsigned long long) nCounted[1]);
+            nFailed++;
+        }
+
+        printf("test_fixbits: --fix-bits %d, as expected 1 bit %d/%d 2 bit %d/%d, 3 bit miscorrected %d/%d, DF11 1 bit fixed %d/%d\n",
+               nFixBits, nFixed[0], nTried[0], nFixed[1], nTried[1], nMiscorrected, nTriples, nAllCallFixed, nAllCallTried);
+    }
+
+    printf("test_fixbits: %ld failed\n", nFailed);
+    return (nFailed ? 1 : 0);
+}
+//
+//=========================================================================
+//